@@ -2,15 +2,37 @@
 
 #pragma OPENCL EXTENSION cl_khr_local_int32_base_atomics : enable
 
+// The host may specialize the program by passing the bin count, the number of
+// pixels per work item and the work group size as compile-time constants.
+#ifndef NUM_BINS
+#define NUM_BINS 256
+#endif
+
+#ifdef NUM_PIXELS_PER_WORKITEM
+#define PIXELS_PER_WORKITEM NUM_PIXELS_PER_WORKITEM
+#else
+#define PIXELS_PER_WORKITEM num_pixels_per_workitem
+#endif
+
+#if defined(GROUP_SIZE_X) && defined(GROUP_SIZE_Y)
+#define LOCAL_SIZE (GROUP_SIZE_X * GROUP_SIZE_Y)
+#define LOCAL_ID (get_local_id(0) + get_local_id(1) * GROUP_SIZE_X)
+#define REQD_GROUP_SIZE __attribute__((reqd_work_group_size(GROUP_SIZE_X, GROUP_SIZE_Y, 1)))
+#else
+#define LOCAL_SIZE (get_local_size(0) * get_local_size(1))
+#define LOCAL_ID (get_local_id(0) + get_local_id(1) * get_local_size(0))
+#define REQD_GROUP_SIZE
+#endif
+
 constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
 
-kernel void histogram(image2d_t img, int num_pixels_per_workitem, global uint *buf)
+kernel REQD_GROUP_SIZE void histogram(image2d_t img, int num_pixels_per_workitem, global uint *buf)
 {
-    int local_size = get_local_size(0) * get_local_size(1);
-    int item_offset = get_local_id(0) + get_local_id(1) * get_local_size(0);
-    local uint tmp[256];
+    int local_size = LOCAL_SIZE;
+    int item_offset = LOCAL_ID;
+    local uint tmp[NUM_BINS];
 
-    int i = 0, j = 256;
+    int i = 0, j = NUM_BINS;
     do {
         if (item_offset < j)
             tmp[item_offset + i] = 0;
@@ -21,21 +43,21 @@ kernel void histogram(image2d_t img, int num_pixels_per_workitem, global uint *b
     barrier(CLK_LOCAL_MEM_FENCE);
 
     int x, image_width = get_image_width(img), image_height = get_image_height(img);
-    for (i = 0, x = get_global_id(0); i < num_pixels_per_workitem; ++i, x += get_global_size(0)) {
+    for (i = 0, x = get_global_id(0); i < PIXELS_PER_WORKITEM; ++i, x += get_global_size(0)) {
         if (x < image_width && get_global_id(1) < image_height) {
             float4 clr = read_imagef(img, sampler, (int2)(x, get_global_id(1)));
             if (clr.w > 0.99f) {
                 float v = (clr.x + clr.y + clr.z) / 3.0f;
-                atom_inc(&tmp[convert_ushort_sat(min(v, 1.0f) * 255.0f)]);
+                atom_inc(&tmp[convert_ushort_sat(min(v, 1.0f) * (NUM_BINS - 1))]);
             }
         }
     }
 
     barrier(CLK_LOCAL_MEM_FENCE);
 
-    int group_offset = (get_group_id(0) + get_group_id(1) * get_num_groups(0)) * 256;
+    int group_offset = (get_group_id(0) + get_group_id(1) * get_num_groups(0)) * NUM_BINS;
     i = 0;
-    j = 256;
+    j = NUM_BINS;
     do {
         if (item_offset < j)
             buf[group_offset + item_offset + i] = tmp[item_offset + i];
@@ -51,7 +73,7 @@ kernel void sum_histogram(global uint *buf, int num_groups, global uint *result)
     int group_offset = 0, n = num_groups;
     while (--n >= 0) {
         v += buf[group_offset + idx];
-        group_offset += 256;
+        group_offset += NUM_BINS;
     }
     result[idx] = v;
 }
@@ -51,6 +51,12 @@
 
 static bool profile = false;
 
+// These are baked into the OpenCL program as compile-time constants.
+static const int NUM_BINS = 256;
+static const int NUM_PIXELS_PER_WORKITEM = 32;
+static const int GROUP_SIZE_X = 16;
+static const int GROUP_SIZE_Y = 8;
+
 class HistogramModel : public QAbstractListModel
 {
     Q_OBJECT
@@ -104,14 +110,14 @@ public:
         if (m_source != source) {
             m_source = source;
             emit sourceChanged();
-            update();
+            scheduleUpdate();
         }
     }
 
     QAbstractItemModel *result() const { return m_result; }
     void updateResult(const QByteArray &histogram) {
         const cl_uint *p = (const cl_uint *) histogram.constData();
-        QVector<uint> v(256);
+        QVector<uint> v(NUM_BINS);
         for (int i = 0; i < v.count(); ++i)
             v[i] = p[i];
         m_result->setHistogram(v);
@@ -163,26 +169,29 @@ CLRunnable::CLRunnable(CLItem *item)
     QQuickCLContext *clctx = m_item->context();
     QByteArray platform = clctx->platformName();
     qDebug("Using platform %s", platform.constData());
-    m_program = clctx->buildProgramFromFile(QStringLiteral(":/histogram.cl"));
+    // Specialize the program for our bin count and work group configuration
+    // so that the compiler can unroll the loops in the kernels.
+    QQuickCLContext::DefineMap defines;
+    defines.insert("NUM_BINS", QByteArray::number(NUM_BINS));
+    defines.insert("NUM_PIXELS_PER_WORKITEM", QByteArray::number(NUM_PIXELS_PER_WORKITEM));
+    defines.insert("GROUP_SIZE_X", QByteArray::number(GROUP_SIZE_X));
+    defines.insert("GROUP_SIZE_Y", QByteArray::number(GROUP_SIZE_Y));
+    m_program = clctx->buildProgramFromFile(QStringLiteral(":/histogram.cl"), QByteArray(), defines);
     if (!m_program)
         return;
-    cl_int err;
-    m_kernel = clCreateKernel(m_program, "histogram", &err);
-    if (!m_kernel) {
-        qWarning("Failed to create histogram OpenCL kernel: %d", err);
+    m_kernel = clctx->createKernel(m_program, "histogram");
+    if (!m_kernel)
         return;
-    }
-    m_sumKernel = clCreateKernel(m_program, "sum_histogram", &err);
-    if (!m_sumKernel) {
-        qWarning("Failed to create sum histogram OpenCL kernel: %d", err);
+    m_sumKernel = clctx->createKernel(m_program, "sum_histogram");
+    if (!m_sumKernel)
         return;
-    }
-    m_resultBuf = clCreateBuffer(clctx->context(), CL_MEM_WRITE_ONLY, 256 * sizeof(cl_uint), 0, &err);
+    cl_int err;
+    m_resultBuf = clCreateBuffer(clctx->context(), CL_MEM_WRITE_ONLY, NUM_BINS * sizeof(cl_uint), 0, &err);
     if (!m_resultBuf) {
         qWarning("Failed to create OpenCL buffer: %d", err);
         return;
     }
-    m_result.resize(256 * sizeof(cl_uint));
+    m_result.resize(NUM_BINS * sizeof(cl_uint));
 }
 
 CLRunnable::~CLRunnable()
@@ -216,16 +225,18 @@ void CLRunnable::runKernel(cl_mem inImage, cl_mem, const QSize &size)
     if (!m_program || !m_kernel || !m_sumKernel || !m_resultBuf)
         return;
 
-    if (!m_resultPending.testAndSetOrdered(0, 1))
+    if (!m_resultPending.testAndSetOrdered(0, 1)) {
+        m_item->clStats()->addSkippedFrame();
         return;
+    }
     PendingGuard pg(this);
 
     if (profile)
         qDebug("CL time: %f ms", elapsed());
 
-    const size_t group_size_x = 16;
-    const size_t group_size_y = 8;
-    const cl_int num_pixels_per_item = 32;
+    const size_t group_size_x = GROUP_SIZE_X;
+    const size_t group_size_y = GROUP_SIZE_Y;
+    const cl_int num_pixels_per_item = NUM_PIXELS_PER_WORKITEM;
     const size_t num_items_per_row = DIV(size.width(), num_pixels_per_item);
     const size_t num_groups_x = DIV(num_items_per_row, group_size_x);
     const size_t num_groups_y = DIV(size.height(), group_size_y);
@@ -236,7 +247,7 @@ void CLRunnable::runKernel(cl_mem inImage, cl_mem, const QSize &size)
 
     cl_int err;
     if (!m_sharedBuf) {
-        const size_t sharedBufSize = num_groups * 256 * sizeof(cl_uint);
+        const size_t sharedBufSize = num_groups * NUM_BINS * sizeof(cl_uint);
         m_sharedBuf = clCreateBuffer(m_item->context()->context(), CL_MEM_READ_WRITE, sharedBufSize, 0, &err);
         if (!m_sharedBuf) {
             qWarning("Failed to create shared buffer: %d", err);
@@ -256,8 +267,8 @@ void CLRunnable::runKernel(cl_mem inImage, cl_mem, const QSize &size)
     clSetKernelArg(m_sumKernel, 0, sizeof(cl_mem), &m_sharedBuf);
     clSetKernelArg(m_sumKernel, 1, sizeof(cl_int), &num_groups);
     clSetKernelArg(m_sumKernel, 2, sizeof(cl_mem), &m_resultBuf);
-    const size_t sumLocalWorkSize = 256;
-    const size_t sumGlobalWorkSize = 256;
+    const size_t sumLocalWorkSize = NUM_BINS;
+    const size_t sumGlobalWorkSize = NUM_BINS;
     err = clEnqueueNDRangeKernel(commandQueue(), m_sumKernel, 1, 0, &sumGlobalWorkSize, &sumLocalWorkSize, 0, 0, 0);
     if (err != CL_SUCCESS) {
         qWarning("Failed to enqueue sum kernel: %d", err);
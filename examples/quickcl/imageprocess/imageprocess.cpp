@@ -47,8 +47,11 @@
 #include <QQuickCLItem>
 #include <QQuickCLImageRunnable>
 #include <QQuickCLContext>
+#include <QQuickCLKernelBinding>
+#include <QQuickCLStatsOverlay>
 
 static bool profile = false;
+static bool adaptive = false;
 
 class CLItem : public QQuickCLItem
 {
@@ -66,7 +69,7 @@ public:
         if (m_source != source) {
             m_source = source;
             emit sourceChanged();
-            update();
+            scheduleUpdate();
         }
     }
 
@@ -75,7 +78,7 @@ public:
         if (m_factor != v) {
             m_factor = v;
             emit factorChanged();
-            update();
+            scheduleUpdate();
         }
     }
 
@@ -93,12 +96,15 @@ class CLRunnable : public QQuickCLImageRunnable
 public:
     CLRunnable(CLItem *item);
     ~CLRunnable();
-    void runKernel(cl_mem inImage, cl_mem outImage, const QSize &size) Q_DECL_OVERRIDE;
+    void runStage(int stage, const QVector<cl_mem> &inputs, cl_mem outImage, const QSize &size) Q_DECL_OVERRIDE;
 
 private:
+    enum Stage { BlurStage, EmbossStage, StageCount };
+
     CLItem *m_item;
-    cl_program m_clProgram;
-    cl_kernel m_clKernel;
+    QQuickCLProgramBuild m_clBuild;
+    cl_kernel m_clKernel[StageCount];
+    QQuickCLKernelBinding *m_embossArgs;
 };
 
 QQuickCLRunnable *CLItem::createCL()
@@ -108,6 +114,14 @@ QQuickCLRunnable *CLItem::createCL()
 
 static const char *openclSrc =
         "__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;\n"
+        "__kernel void Blur(__read_only image2d_t imgIn, __write_only image2d_t imgOut) {\n"
+        "    const int2 pos = { get_global_id(0), get_global_id(1) };\n"
+        "    float4 sum = (float4)(0.0f);\n"
+        "    for (int y = -1; y <= 1; ++y)\n"
+        "        for (int x = -1; x <= 1; ++x)\n"
+        "            sum += read_imagef(imgIn, sampler, pos + (int2)(x, y));\n"
+        "    write_imagef(imgOut, pos, sum / 9.0f);\n"
+        "}\n"
         "__kernel void Emboss(__read_only image2d_t imgIn, __write_only image2d_t imgOut, float factor) {\n"
         "    const int2 pos = { get_global_id(0), get_global_id(1) };\n"
         "    float4 diff = read_imagef(imgIn, sampler, pos + (int2)(1,1)) - read_imagef(imgIn, sampler, pos - (int2)(1,1));\n"
@@ -116,50 +130,69 @@ static const char *openclSrc =
         "}\n";
 
 CLRunnable::CLRunnable(CLItem *item)
-    : QQuickCLImageRunnable(item, profile ? Profile : Flag(0)),
+    : QQuickCLImageRunnable(item, SkipUnchanged | PartialUpdates | (profile ? Profile : Flag(0))
+                            | (adaptive ? ScaleToItemSize | AdaptiveResolution : Flag(0))),
       m_item(item),
-      m_clProgram(0),
-      m_clKernel(0)
+      m_embossArgs(0)
 {
+    m_clKernel[BlurStage] = m_clKernel[EmbossStage] = 0;
+    // Blur first, then emboss the blurred image. The intermediate image is
+    // managed by QQuickCLImageRunnable and the two kernels run between a
+    // single acquire and release of the textures.
+    addStage();
+    addStage();
+    // Both kernels read the neighboring pixels. When only a part of the
+    // source changes, only that area plus this margin is processed.
+    setDirtyRectMargin(1);
+
     QQuickCLContext *clctx = m_item->context();
     QByteArray platform = clctx->platformName();
     qDebug("Using platform %s", platform.constData());
-    m_clProgram = clctx->buildProgram(openclSrc);
-    if (!m_clProgram)
-        return;
-    cl_int err;
-    m_clKernel = clCreateKernel(m_clProgram, "Emboss", &err);
-    if (!m_clKernel) {
-        qWarning("Failed to create emboss OpenCL kernel: %d", err);
-        return;
-    }
+    // Build on a worker thread. runKernel() will not get called before the
+    // build finishes and the item gets updated automatically afterwards.
+    // The emboss filter does not need strict IEEE float semantics.
+    m_clBuild = clctx->buildProgramAsync(openclSrc, "-cl-fast-relaxed-math -cl-mad-enable",
+                                         QQuickCLContext::DefineMap(), item);
+    addProgramBuild(m_clBuild);
 }
 
 CLRunnable::~CLRunnable()
 {
-    if (m_clKernel)
-        clReleaseKernel(m_clKernel);
-    if (m_clProgram)
-        clReleaseProgram(m_clProgram);
+    delete m_embossArgs;
+    for (int i = 0; i < StageCount; ++i) {
+        if (m_clKernel[i])
+            clReleaseKernel(m_clKernel[i]);
+    }
 }
 
-void CLRunnable::runKernel(cl_mem inImage, cl_mem outImage, const QSize &size)
+void CLRunnable::runStage(int stage, const QVector<cl_mem> &inputs, cl_mem outImage, const QSize &size)
 {
-    if (!m_clProgram)
-        return;
+    if (!m_clKernel[stage]) {
+        if (!m_clBuild.program())
+            return;
+        // The program is shared by all CLItem instances, the kernels are not.
+        m_clKernel[stage] = m_item->context()->createKernel(m_clBuild.program(), stage == BlurStage ? "Blur" : "Emboss");
+        if (!m_clKernel[stage])
+            return;
+        if (stage == EmbossStage) {
+            // The factor argument follows the item's property. It is only
+            // passed to OpenCL again when the value changes.
+            m_embossArgs = new QQuickCLKernelBinding(m_item, m_clKernel[stage]);
+            m_embossArgs->bind(2, "factor", QQuickCLKernelBinding::Float);
+        }
+    }
 
-    if (profile)
+    if (profile && stage == BlurStage)
         qDebug("CL time: %f", elapsed());
 
-    clSetKernelArg(m_clKernel, 0, sizeof(cl_mem), &inImage);
-    clSetKernelArg(m_clKernel, 1, sizeof(cl_mem), &outImage);
-    const cl_float factor = m_item->factor();
-    clSetKernelArg(m_clKernel, 2, sizeof(cl_float), &factor);
+    cl_kernel kernel = m_clKernel[stage];
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), &inputs[0]);
+    clSetKernelArg(kernel, 1, sizeof(cl_mem), &outImage);
+    if (stage == EmbossStage)
+        m_embossArgs->apply();
 
-    const size_t workSize[] = { size_t(size.width()), size_t(size.height()) };
-    cl_int err = clEnqueueNDRangeKernel(commandQueue(), m_clKernel, 2, 0, workSize, 0, 0, 0, 0);
-    if (err != CL_SUCCESS)
-        qWarning("Failed to enqueue kernel: %d", err);
+    Q_UNUSED(size);
+    enqueueKernel(kernel);
 }
 
 int main(int argc, char **argv)
@@ -171,11 +204,16 @@ int main(int argc, char **argv)
 
     if (app.arguments().contains(QStringLiteral("--profile")))
         profile = true;
+    // Process at most at the displayed size and lower the resolution further
+    // when the kernels take longer than 8 ms.
+    if (app.arguments().contains(QStringLiteral("--adaptive")))
+        adaptive = true;
 
     QQuickView view;
     QObject::connect(view.engine(), SIGNAL(quit()), &app, SLOT(quit()));
 
     qmlRegisterType<CLItem>("quickcl.qt.io", 1, 0, "CLItem");
+    QQuickCLStatsOverlay::registerQmlTypes("quickcl.qt.io", 1, 0);
 
     view.setSource(QUrl("qrc:///qml/imageprocess.qml"));
     view.setResizeMode(QQuickView::SizeRootObjectToView);
@@ -125,5 +125,12 @@ Item {
             font.pointSize: 16
             color: "green"
         }
+
+        CLStatsOverlay {
+            anchors.right: parent.right
+            anchors.bottom: parent.bottom
+            anchors.margins: 10
+            stats: clItem.clStats
+        }
     }
 }
@@ -50,6 +50,7 @@
 #include <QQuickCLItem>
 #include <QQuickCLRunnable>
 #include <QQuickCLContext>
+#include <QQuickCLGLSync>
 #include <time.h>
 
 const int PARTICLE_COUNT = 1024;
@@ -122,7 +123,7 @@ private:
     cl_kernel m_kernel;
     cl_event m_computeDoneEvent;
     QSize m_itemSize;
-    bool m_needsExplicitSync;
+    QQuickCLGLSync *m_sync;
     QAtomicInt m_computeInProgress;
     qreal m_lastT;
     cl_mem m_clBufParticleInfo;
@@ -144,7 +145,7 @@ public:
         if (m_t != v) {
             m_t = v;
             emit tChanged();
-            update();
+            scheduleUpdate();
         }
     }
 
@@ -214,15 +215,21 @@ CLRunnable::CLRunnable(CLItem *item)
     : m_item(item),
       m_node(0),
       m_recreateFbo(false),
+      m_queue(0),
       m_program(0),
       m_kernel(0),
       m_computeDoneEvent(0),
+      m_sync(0),
       m_lastT(-1),
       m_clBufParticleInfo(0)
 {
     QQuickCLContext *clctx = m_item->context();
 
     qDebug() << "Platform" << clctx->platformName() << "Device extensions" << clctx->deviceExtensions();
+    if (!clctx->isGLInteropEnabled()) {
+        qWarning("This example requires CL-GL interop");
+        return;
+    }
     cl_int err;
 
     m_queue = clCreateCommandQueue(clctx->context(), clctx->device(), 0, &err);
@@ -234,13 +241,12 @@ CLRunnable::CLRunnable(CLItem *item)
     m_program = clctx->buildProgramFromFile(QStringLiteral(":/particles.cl"));
     if (!m_program)
         return;
-    m_kernel = clCreateKernel(m_program, "updateParticles", &err);
-    if (!m_kernel) {
-        qWarning("Failed to create particles OpenCL kernel: %d", err);
+    m_kernel = clctx->createKernel(m_program, "updateParticles");
+    if (!m_kernel)
         return;
-    }
 
-    m_needsExplicitSync = !clctx->deviceExtensions().contains(QByteArrayLiteral("cl_khr_gl_event"));
+    // Avoids glFinish() and clFinish() when the necessary extensions are present.
+    m_sync = new QQuickCLGLSync(clctx, m_queue);
 
     // m_clBufParticleInfo is an ordinary OpenCL buffer.
     size_t velBufSize = PARTICLE_COUNT * sizeof(cl_float) * 4;
@@ -268,6 +274,7 @@ CLRunnable::CLRunnable(CLItem *item)
 
 CLRunnable::~CLRunnable()
 {
+    delete m_sync;
     if (m_clBufParticleInfo)
         clReleaseMemObject(m_clBufParticleInfo);
     if (m_kernel)
@@ -336,7 +343,7 @@ private:
 
 QSGNode *CLRunnable::update(QSGNode *node)
 {
-    if (!m_queue || !m_program || !m_kernel || !m_clBufParticleInfo)
+    if (!m_queue || !m_program || !m_kernel || !m_clBufParticleInfo || !m_sync)
         return 0;
 
     if (!node) {
@@ -364,18 +371,18 @@ QSGNode *CLRunnable::update(QSGNode *node)
     if (m_lastT == m_item->t())
         return node;
 
-    if (!m_computeInProgress.testAndSetOrdered(0, 1))
+    if (!m_computeInProgress.testAndSetOrdered(0, 1)) {
+        m_item->clStats()->addSkippedFrame();
         return node;
+    }
 
     StateGuard sg(this);
 
     cl_float dt = m_item->t() - m_lastT;
     m_lastT = m_item->t();
 
-    if (m_needsExplicitSync)
-        QOpenGLContext::currentContext()->functions()->glFinish();
-
-    cl_int err = clEnqueueAcquireGLObjects(m_queue, 1, &m_node->m_clBuf, 0, 0, 0);
+    cl_event glDone = m_sync->acquireFromGL();
+    cl_int err = clEnqueueAcquireGLObjects(m_queue, 1, &m_node->m_clBuf, glDone ? 1 : 0, glDone ? &glDone : 0, 0);
     if (err != CL_SUCCESS) {
         qWarning("Failed to queue acquiring the GL buffer: %d", err);
         return node;
@@ -399,12 +406,13 @@ QSGNode *CLRunnable::update(QSGNode *node)
         return node;
     }
 
+    // The buffer is only used for rendering once eventCompleted() has been
+    // called, so there is no need to block here.
+    m_sync->releaseToGL(m_computeDoneEvent, QQuickCLGLSync::DeferCompletion);
+
     sg.release();
     m_item->watchEvent(m_computeDoneEvent);
 
-    if (m_needsExplicitSync)
-        clFinish(m_queue);
-
     return node;
 }
 
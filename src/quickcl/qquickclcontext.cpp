@@ -35,10 +35,27 @@
 ****************************************************************************/
 
 #include "qquickclcontext.h"
+#include "qquickclitem.h"
+#include "qquickclstats_p.h"
 
 #include <QtGui/QOpenGLContext>
 #include <QtGui/QOpenGLFunctions>
+#include <QtCore/QCoreApplication>
 #include <QtCore/QLoggingCategory>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QPointer>
+#include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
 #include <qpa/qplatformnativeinterface.h>
 
 QT_BEGIN_NAMESPACE
@@ -54,7 +71,68 @@ Q_LOGGING_CATEGORY(logCL, "qt.quickcl")
     as QQuickCLItem takes care of creating and destroying a QQuickCLContext
     instance as necessary.
 
-    \note This class assumes that OpenCL 1.1 and CL-GL interop are available.
+    Contexts can either be created and owned directly, or retrieved via
+    acquireShared(). The latter returns a reference counted context that is
+    shared by everyone rendering with an OpenGL context from the same share
+    group. This is what QQuickCLItem uses: all items in a window, and all
+    windows when Qt::AA_ShareOpenGLContexts is set, end up with the same
+    OpenCL context, meaning the (potentially expensive) initialization is
+    performed only once and memory objects can be passed between items.
+
+    \section1 Program cache
+
+    Programs are cached in memory per context: building the same source with
+    the same options again, for example because many instances of the same
+    QQuickCLItem subclass are present in the scene, returns the already built
+    program with its reference count increased instead of compiling it again.
+    Kernels for the individual users are then best created with
+    createKernel().
+
+    \section1 Build options and specialization
+
+    buildProgram(), buildProgramFromFile() and buildProgramAsync() have
+    overloads taking build options, for example \c{-cl-fast-relaxed-math}, and
+    a map of preprocessor defines. The program cache is keyed by the final set
+    of options, so building the same source with different defines results in
+    separate, specialized programs, while repeated builds of the same variant
+    are served from the cache. This makes it cheap to bake values like the
+    image channel count or the number of histogram bins into the kernels as
+    compile-time constants, allowing the compiler to unroll loops and drop
+    bounds checks.
+
+    \section1 Asynchronous builds
+
+    Building a program can take a considerable amount of time. As programs
+    are typically built on the scenegraph's render thread, this can lead to
+    visible stutter in animations. To avoid this, buildProgramAsync() can be
+    used instead of buildProgram(). It returns a QQuickCLProgramBuild handle
+    immediately and performs the build on a worker thread.
+
+    \section1 Program binary cache
+
+    Programs built via buildProgram() and buildProgramFromFile() are cached on
+    disk in form of the binaries reported by CL_PROGRAM_BINARIES. The cache is
+    keyed by the program source, the build options, and the name and driver
+    version of the platform and device, so changing any of them results in a
+    new build. The binaries are written by atomically renaming a temporary
+    file, so multiple processes can safely share the same cache directory.
+
+    The cache is stored in a \c qtquickcl subdirectory of
+    QStandardPaths::CacheLocation by default. This can be overridden by
+    setting the environment variable \c QT_QUICKCL_PROGRAM_CACHE_DIR. Setting
+    \c QT_QUICKCL_NO_PROGRAM_CACHE disables the cache completely.
+
+    \section1 Device selection
+
+    By default a GPU device is chosen. When an OpenGL context is current
+    during create(), the device used by the OpenGL implementation is preferred
+    so that CL-GL interop can be enabled. This can be customized by passing a
+    QQuickCLDeviceSelector to create() or by changing the default selector
+    via setDefaultDeviceSelector(). The default selector can also be
+    specified by setting the environment variable \c QT_QUICKCL_DEVICE, see
+    QQuickCLDeviceSelector::fromString() for the syntax.
+
+    \note This class assumes that OpenCL 1.1 is available.
  */
 
 class QQuickCLContextPrivate
@@ -63,13 +141,165 @@ public:
     QQuickCLContextPrivate()
         : platform(0),
           device(0),
-          context(0)
+          context(0),
+          shareGroup(0),
+          sharedRef(0),
+          deviceVersion(0),
+          glInterop(false)
     { }
 
+    bool createInteropContext(QOpenGLContext *ctx, const QVector<cl_platform_id> &platformIds,
+                              const QQuickCLDeviceSelector &selector, cl_device_type type);
+    bool createContext(const QVector<cl_platform_id> &platformIds,
+                       const QQuickCLDeviceSelector &selector, cl_device_type type);
+
+    cl_program buildProgram(const QByteArray &src, const QByteArray &options, double *buildTime = 0);
+    cl_program compileProgram(const QByteArray &src, const QByteArray &options, const QByteArray &key);
+    QByteArray programCacheKey(const QByteArray &src, const QByteArray &options) const;
+    cl_program loadProgramBinary(const QString &fileName, const QByteArray &options);
+    void saveProgramBinary(const QString &fileName, cl_program prog);
+
     cl_platform_id platform;
     cl_device_id device;
     cl_context context;
+    QOpenGLContextGroup *shareGroup;
+    int sharedRef;
+    QByteArray deviceIdentity;
+    int deviceVersion;
+    bool glInterop;
+
+    QMutex programMutex;
+    QHash<QByteArray, cl_program> programs;
+    QHash<QPair<cl_program, QByteArray>, cl_kernel> kernelPrototypes;
+
+    QThreadPool buildPool;
+};
+
+static const int EV_BUILD_FINISHED = QEvent::User + 132;
+
+// Delivers the completion of an asynchronous build to the item on the gui
+// thread. The item may be destroyed while the build is running, therefore
+// the build thread only posts to the notifier, which deletes itself.
+class ProgramBuildNotifier : public QObject
+{
+public:
+    ProgramBuildNotifier(QQuickCLItem *item) : item(item), buildTime(0) { moveToThread(item->thread()); }
+
+    void post(double ms) {
+        buildTime = ms;
+        QCoreApplication::postEvent(this, new QEvent(QEvent::Type(EV_BUILD_FINISHED)));
+    }
+
+protected:
+    bool event(QEvent *e) Q_DECL_OVERRIDE {
+        if (e->type() != EV_BUILD_FINISHED)
+            return QObject::event(e);
+        if (item) {
+            if (buildTime > 0)
+                item->clStats()->addBuildTime(buildTime);
+            item->scheduleUpdate();
+        }
+        deleteLater();
+        return true;
+    }
+
+private:
+    QPointer<QQuickCLItem> item;
+    double buildTime;
+};
+
+class QQuickCLProgramBuildPrivate
+{
+public:
+    QQuickCLProgramBuildPrivate() : program(0), finished(false), notifier(0) { }
+    ~QQuickCLProgramBuildPrivate() {
+        if (program)
+            clReleaseProgram(program);
+    }
+
+    QByteArray src;
+    QByteArray options;
+    cl_program program;
+    QAtomicInt finished;
+    QMutex mutex;
+    QWaitCondition finishedCondition;
+    ProgramBuildNotifier *notifier;
+};
+
+class ProgramBuildRunnable : public QRunnable
+{
+public:
+    ProgramBuildRunnable(QQuickCLContextPrivate *context, const QSharedPointer<QQuickCLProgramBuildPrivate> &build)
+        : context(context), build(build) { }
+
+    void run() Q_DECL_OVERRIDE {
+        double buildTime = 0;
+        cl_program prog = context->buildProgram(build->src, build->options, &buildTime);
+        QMutexLocker lock(&build->mutex);
+        build->program = prog;
+        build->finished.storeRelease(true);
+        build->finishedCondition.wakeAll();
+        lock.unlock();
+        if (build->notifier)
+            build->notifier->post(buildTime);
+    }
+
+private:
+    QQuickCLContextPrivate *context;
+    QSharedPointer<QQuickCLProgramBuildPrivate> build;
+};
+
+static const char programBinaryMagic[] = "QQCLBIN1";
+static const int programBinaryMagicSize = sizeof(programBinaryMagic) - 1;
+
+static QString programCacheDir()
+{
+    if (qEnvironmentVariableIsSet("QT_QUICKCL_NO_PROGRAM_CACHE"))
+        return QString();
+    QString dir = QFile::decodeName(qgetenv("QT_QUICKCL_PROGRAM_CACHE_DIR"));
+    if (dir.isEmpty()) {
+        dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+        if (dir.isEmpty())
+            return QString();
+        dir += QStringLiteral("/qtquickcl");
+    }
+    return dir;
+}
+
+static QByteArray platformInfo(cl_platform_id platform, cl_platform_info param)
+{
+    size_t size = 0;
+    if (clGetPlatformInfo(platform, param, 0, 0, &size) != CL_SUCCESS || !size)
+        return QByteArray();
+    QByteArray value(int(size), '\0');
+    clGetPlatformInfo(platform, param, size, value.data(), 0);
+    value.resize(int(strlen(value.constData())));
+    return value;
+}
+
+static QByteArray deviceInfo(cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    if (clGetDeviceInfo(device, param, 0, 0, &size) != CL_SUCCESS || !size)
+        return QByteArray();
+    QByteArray value(int(size), '\0');
+    clGetDeviceInfo(device, param, size, value.data(), 0);
+    value.resize(int(strlen(value.constData())));
+    return value;
+}
+
+struct DefaultDeviceSelector
+{
+    DefaultDeviceSelector() : initialized(false) { }
+    QMutex mutex;
+    bool initialized;
+    QQuickCLDeviceSelector selector;
 };
+Q_GLOBAL_STATIC(DefaultDeviceSelector, defaultSelector)
+
+typedef QHash<QOpenGLContextGroup *, QQuickCLContext *> SharedContextHash;
+Q_GLOBAL_STATIC(SharedContextHash, sharedContexts)
+Q_GLOBAL_STATIC(QMutex, sharedContextMutex)
 
 /*!
     Constructs a new instance of QQuickCLContext.
@@ -143,32 +373,40 @@ cl_context QQuickCLContext::context() const
 }
 
 /*!
-    Creates a new OpenCL context.
+    Creates a new OpenCL context using the default device selector.
 
     If a context was already created, it is destroyed first.
 
-    An OpenGL context must be current at the time of calling this function.
-    This ensures that the OpenCL platform matching the OpenGL implementation's
-    vendor is selected and that CL-GL interop is enabled for the context.
+    When an OpenGL context is current at the time of calling this function,
+    the OpenCL platform and device matching the OpenGL implementation are
+    selected and CL-GL interop is enabled for the context, unless this is
+    disabled in the selector or not supported by the implementation. In that
+    case a context without interop is created and isGLInteropEnabled() returns
+    \c false.
 
     If something fails, warnings are logged with the \c qt.quickcl category.
 
     \return \c true if successful.
+
+    \sa defaultDeviceSelector(), QQuickCLDeviceSelector
  */
 bool QQuickCLContext::create()
+{
+    return create(defaultDeviceSelector());
+}
+
+/*!
+    \overload
+
+    Creates a new OpenCL context on a device chosen according to \a selector.
+ */
+bool QQuickCLContext::create(const QQuickCLDeviceSelector &selector)
 {
     Q_D(QQuickCLContext);
 
     destroy();
     qCDebug(logCL, "Creating new OpenCL context");
 
-    QOpenGLContext *ctx = QOpenGLContext::currentContext();
-    if (!ctx) {
-        qWarning("Attempted CL-GL interop without a current OpenGL context");
-        return false;
-    }
-    QOpenGLFunctions *f = ctx->functions();
-
     cl_uint n;
     cl_int err = clGetPlatformIDs(0, 0, &n);
     if (err != CL_SUCCESS) {
@@ -192,96 +430,275 @@ bool QQuickCLContext::create()
         qWarning("Failed to get platform IDs");
         return false;
     }
-    d->platform = platformIds[0];
-    const char *vendor = (const char *) f->glGetString(GL_VENDOR);
-    qCDebug(logCL, "GL_VENDOR: %s", vendor);
-    const bool isNV = vendor && strstr(vendor, "NVIDIA");
-    const bool isIntel = vendor && strstr(vendor, "Intel");
-    const bool isAMD = vendor && strstr(vendor, "ATI");
     qCDebug(logCL, "Found %u OpenCL platforms:", n);
-    for (cl_uint i = 0; i < n; ++i) {
-        QByteArray name;
-        name.resize(1024);
-        clGetPlatformInfo(platformIds[i], CL_PLATFORM_NAME, name.size(), name.data(), 0);
-        qCDebug(logCL, "Platform %p: %s", platformIds[i], name.constData());
-        if (isNV && name.contains(QByteArrayLiteral("NVIDIA")))
-            d->platform = platformIds[i];
-        else if (isIntel && name.contains(QByteArrayLiteral("Intel")))
-            d->platform = platformIds[i];
-        else if (isAMD && name.contains(QByteArrayLiteral("AMD")))
-            d->platform = platformIds[i];
+    for (cl_uint i = 0; i < n; ++i)
+        qCDebug(logCL, "Platform %p: %s", platformIds[i], platformInfo(platformIds[i], CL_PLATFORM_NAME).constData());
+
+    // Unless specified otherwise, prefer GPUs but fall back to anything else.
+    const cl_device_type type = selector.deviceType() ? selector.deviceType() : CL_DEVICE_TYPE_GPU;
+
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    if (ctx && selector.isInteropPreferred()) {
+        d->glInterop = d->createInteropContext(ctx, platformIds, selector, type);
+        if (!d->glInterop)
+            qWarning("CL-GL interop is not available, creating an OpenCL context without interop");
     }
+
+    if (!d->context && !d->createContext(platformIds, selector, type)
+            && (selector.deviceType() || !d->createContext(platformIds, selector, CL_DEVICE_TYPE_ALL))) {
+        qWarning("No suitable OpenCL device found");
+        return false;
+    }
+
     qCDebug(logCL, "Using platform %p", d->platform);
+    qCDebug(logCL, "Using context %p", d->context);
+    qCDebug(logCL, "Using device %p: %s", d->device, deviceInfo(d->device, CL_DEVICE_NAME).constData());
+    qCDebug(logCL, "CL-GL interop %s", d->glInterop ? "enabled" : "disabled");
 
-#if defined (Q_OS_OSX)
-    cl_context_properties contextProps[] = { CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE,
-                                             (cl_context_properties) CGLGetShareGroup(CGLGetCurrentContext()),
-                                             0 };
-#elif defined(Q_OS_WIN)
+    d->deviceIdentity = platformInfo(d->platform, CL_PLATFORM_NAME) + '\0'
+            + platformInfo(d->platform, CL_PLATFORM_VERSION) + '\0'
+            + deviceInfo(d->device, CL_DEVICE_NAME) + '\0'
+            + deviceInfo(d->device, CL_DEVICE_VERSION) + '\0'
+            + deviceInfo(d->device, CL_DRIVER_VERSION);
+
+    // CL_DEVICE_VERSION is "OpenCL <major>.<minor> <vendor specific>"
+    const QList<QByteArray> version = deviceInfo(d->device, CL_DEVICE_VERSION).split(' ');
+    if (version.count() > 1) {
+        const QList<QByteArray> majorMinor = version[1].split('.');
+        d->deviceVersion = majorMinor.value(0).toInt() * 100 + majorMinor.value(1).toInt();
+    }
+    qCDebug(logCL, "Device version %d", d->deviceVersion);
+
+    return true;
+}
+
+static bool platformMatches(cl_platform_id platform, const QQuickCLDeviceSelector &selector)
+{
+    return selector.platformName().isEmpty()
+            || platformInfo(platform, CL_PLATFORM_NAME).toLower().contains(selector.platformName().toLower());
+}
+
+static bool deviceMatches(cl_device_id device, const QQuickCLDeviceSelector &selector, cl_device_type type)
+{
+    cl_device_type deviceType = 0;
+    clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(deviceType), &deviceType, 0);
+    if (!(deviceType & type))
+        return false;
+    return selector.deviceName().isEmpty()
+            || deviceInfo(device, CL_DEVICE_NAME).toLower().contains(selector.deviceName().toLower());
+}
+
+static quint64 deviceScore(cl_device_id device)
+{
+    cl_uint computeUnits = 0;
+    cl_uint clock = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, 0);
+    clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clock), &clock, 0);
+    return quint64(computeUnits) * clock;
+}
+
+static QVector<cl_device_id> matchingDevices(cl_platform_id platform, const QQuickCLDeviceSelector &selector,
+                                             cl_device_type type)
+{
+    QVector<cl_device_id> result;
+    cl_uint n = 0;
+    if (clGetDeviceIDs(platform, type, 0, 0, &n) != CL_SUCCESS || !n)
+        return result;
+    QVector<cl_device_id> devices(n);
+    if (clGetDeviceIDs(platform, type, n, devices.data(), 0) != CL_SUCCESS)
+        return result;
+    foreach (cl_device_id device, devices) {
+        if (deviceMatches(device, selector, type))
+            result.append(device);
+    }
+    return result;
+}
+
+// Returns the first of devices, or with the FastestDevice policy the one with
+// the highest deviceScore(), which is stored in score.
+static cl_device_id selectDevice(const QVector<cl_device_id> &devices, const QQuickCLDeviceSelector &selector,
+                                 quint64 *score)
+{
+    cl_device_id best = 0;
+    *score = 0;
+    foreach (cl_device_id dev, devices) {
+        const quint64 s = deviceScore(dev);
+        qCDebug(logCL, "Candidate device %p: %s (score %llu)", dev, deviceInfo(dev, CL_DEVICE_NAME).constData(), s);
+        if (!best || (selector.policy() == QQuickCLDeviceSelector::FastestDevice && s > *score)) {
+            best = dev;
+            *score = s;
+        }
+    }
+    return best;
+}
+
+#if !defined(Q_OS_OSX)
+static bool platformMatchesGLVendor(const QByteArray &platformName, const char *vendor)
+{
+    if (!vendor)
+        return false;
+    if (strstr(vendor, "NVIDIA"))
+        return platformName.contains(QByteArrayLiteral("NVIDIA"));
+    if (strstr(vendor, "Intel"))
+        return platformName.contains(QByteArrayLiteral("Intel"));
+    if (strstr(vendor, "ATI") || strstr(vendor, "AMD"))
+        return platformName.contains(QByteArrayLiteral("AMD"));
+    return false;
+}
+
+static bool glContextProperties(QOpenGLContext *ctx, cl_platform_id platform, QVector<cl_context_properties> *props)
+{
+#if defined(Q_OS_WIN)
+    Q_UNUSED(ctx);
     if (QOpenGLContext::openGLModuleType() == QOpenGLContext::LibGLES) {
         // We don't do D3D-CL interop.
         qWarning("ANGLE is not supported");
         return false;
     }
-    cl_context_properties contextProps[] = { CL_CONTEXT_PLATFORM, (cl_context_properties) d->platform,
-                                             CL_GL_CONTEXT_KHR, (cl_context_properties) wglGetCurrentContext(),
-                                             CL_WGL_HDC_KHR, (cl_context_properties) wglGetCurrentDC(),
-                                             0 };
+    *props << CL_CONTEXT_PLATFORM << (cl_context_properties) platform
+           << CL_GL_CONTEXT_KHR << (cl_context_properties) wglGetCurrentContext()
+           << CL_WGL_HDC_KHR << (cl_context_properties) wglGetCurrentDC()
+           << 0;
+    return true;
 #elif defined(Q_OS_LINUX)
-    cl_context_properties contextProps[] = { CL_CONTEXT_PLATFORM, (cl_context_properties) d->platform,
-                                             CL_GL_CONTEXT_KHR, 0,
-                                             0, 0,
-                                             0 };
     QPlatformNativeInterface *nativeIf = qGuiApp->platformNativeInterface();
     void *dpy = nativeIf->nativeResourceForIntegration(QByteArrayLiteral("egldisplay")); // EGLDisplay
     if (dpy) {
         void *nativeContext = nativeIf->nativeResourceForContext("eglcontext", ctx);
-        if (!nativeContext)
+        if (!nativeContext) {
             qWarning("Failed to get the underlying EGL context from the current QOpenGLContext");
-        contextProps[3] = (cl_context_properties) nativeContext;
-        contextProps[4] = CL_EGL_DISPLAY_KHR;
-        contextProps[5] = (cl_context_properties) dpy;
+            return false;
+        }
+        *props << CL_CONTEXT_PLATFORM << (cl_context_properties) platform
+               << CL_GL_CONTEXT_KHR << (cl_context_properties) nativeContext
+               << CL_EGL_DISPLAY_KHR << (cl_context_properties) dpy
+               << 0;
     } else {
         dpy = nativeIf->nativeResourceForIntegration(QByteArrayLiteral("display")); // Display *
         void *nativeContext = nativeIf->nativeResourceForContext("glxcontext", ctx);
-        if (!nativeContext)
+        if (!nativeContext) {
             qWarning("Failed to get the underlying GLX context from the current QOpenGLContext");
-        contextProps[3] = (cl_context_properties) nativeContext;
-        contextProps[4] = CL_GLX_DISPLAY_KHR;
-        contextProps[5] = (cl_context_properties) dpy;
+            return false;
+        }
+        *props << CL_CONTEXT_PLATFORM << (cl_context_properties) platform
+               << CL_GL_CONTEXT_KHR << (cl_context_properties) nativeContext
+               << CL_GLX_DISPLAY_KHR << (cl_context_properties) dpy
+               << 0;
     }
+    return true;
+#else
+    Q_UNUSED(ctx);
+    Q_UNUSED(platform);
+    Q_UNUSED(props);
+    return false;
+#endif
+}
 #endif
 
-    d->context = clCreateContextFromType(contextProps, CL_DEVICE_TYPE_GPU, 0, 0, &err);
-    if (!d->context) {
-        qWarning("Failed to create OpenCL context: %d", err);
+bool QQuickCLContextPrivate::createInteropContext(QOpenGLContext *ctx, const QVector<cl_platform_id> &platformIds,
+                                                  const QQuickCLDeviceSelector &selector, cl_device_type type)
+{
+    cl_int err;
+#if defined(Q_OS_OSX)
+    Q_UNUSED(ctx);
+    Q_UNUSED(platformIds);
+    cl_context_properties contextProps[] = { CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE,
+                                             (cl_context_properties) CGLGetShareGroup(CGLGetCurrentContext()),
+                                             0 };
+    context = clCreateContextFromType(contextProps, type, 0, 0, &err);
+    if (!context) {
+        qCDebug(logCL, "Failed to create CL-GL interop context: %d", err);
         return false;
     }
-    qCDebug(logCL, "Using context %p", d->context);
-
-#if defined(Q_OS_OSX)
-    err = clGetGLContextInfoAPPLE(d->context, CGLGetCurrentContext(),
+    err = clGetGLContextInfoAPPLE(context, CGLGetCurrentContext(),
                                   CL_CGL_DEVICE_FOR_CURRENT_VIRTUAL_SCREEN_APPLE,
-                                  sizeof(cl_device_id), &d->device, 0);
-    if (err != CL_SUCCESS) {
-        qWarning("Failed to get OpenCL device for current screen: %d", err);
-        destroy();
+                                  sizeof(cl_device_id), &device, 0);
+    if (err != CL_SUCCESS || !deviceMatches(device, selector, type)) {
+        qCDebug(logCL, "No suitable OpenCL device for current screen: %d", err);
+        clReleaseContext(context);
+        context = 0;
+        device = 0;
         return false;
     }
+    clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(cl_platform_id), &platform, 0);
+    return true;
 #else
+    const char *vendor = (const char *) ctx->functions()->glGetString(GL_VENDOR);
+    qCDebug(logCL, "GL_VENDOR: %s", vendor);
+
+    // Try the platform matching the OpenGL implementation first.
+    QVector<cl_platform_id> candidates;
+    foreach (cl_platform_id p, platformIds) {
+        if (!platformMatches(p, selector))
+            continue;
+        if (!platformInfo(p, CL_PLATFORM_EXTENSIONS).contains(QByteArrayLiteral("cl_khr_gl_sharing"))) {
+            qCDebug(logCL, "Platform %p does not support cl_khr_gl_sharing", p);
+            continue;
+        }
+        if (platformMatchesGLVendor(platformInfo(p, CL_PLATFORM_NAME), vendor))
+            candidates.prepend(p);
+        else
+            candidates.append(p);
+    }
+
     clGetGLContextInfoKHR_fn getGLContextInfo = (clGetGLContextInfoKHR_fn) clGetExtensionFunctionAddress("clGetGLContextInfoKHR");
-    if (!getGLContextInfo || getGLContextInfo(contextProps, CL_CURRENT_DEVICE_FOR_GL_CONTEXT_KHR,
-                                              sizeof(cl_device_id), &d->device, 0) != CL_SUCCESS) {
-        err = clGetDeviceIDs(d->platform, CL_DEVICE_TYPE_GPU, 1, &d->device, 0);
-        if (err != CL_SUCCESS) {
-            qWarning("Failed to get OpenCL device: %d", err);
-            destroy();
-            return false;
+    foreach (cl_platform_id p, candidates) {
+        QVector<cl_context_properties> contextProps;
+        if (!glContextProperties(ctx, p, &contextProps))
+            continue;
+        cl_device_id dev = 0;
+        if (!getGLContextInfo || getGLContextInfo(contextProps.constData(), CL_CURRENT_DEVICE_FOR_GL_CONTEXT_KHR,
+                                                  sizeof(cl_device_id), &dev, 0) != CL_SUCCESS) {
+            quint64 score;
+            dev = selectDevice(matchingDevices(p, selector, type), selector, &score);
+        }
+        if (!dev || !deviceMatches(dev, selector, type)) {
+            qCDebug(logCL, "No suitable CL-GL interop device on platform %p", p);
+            continue;
+        }
+        context = clCreateContext(contextProps.constData(), 1, &dev, 0, 0, &err);
+        if (!context) {
+            qCDebug(logCL, "Failed to create CL-GL interop context on platform %p: %d", p, err);
+            continue;
         }
+        platform = p;
+        device = dev;
+        return true;
     }
+    return false;
 #endif
-    qCDebug(logCL, "Using device %p", d->device);
+}
 
+bool QQuickCLContextPrivate::createContext(const QVector<cl_platform_id> &platformIds,
+                                           const QQuickCLDeviceSelector &selector, cl_device_type type)
+{
+    cl_platform_id bestPlatform = 0;
+    cl_device_id bestDevice = 0;
+    quint64 bestScore = 0;
+    foreach (cl_platform_id p, platformIds) {
+        if (!platformMatches(p, selector))
+            continue;
+        quint64 score;
+        cl_device_id dev = selectDevice(matchingDevices(p, selector, type), selector, &score);
+        if (dev && (!bestDevice || (selector.policy() == QQuickCLDeviceSelector::FastestDevice
+                                    && score > bestScore))) {
+            bestPlatform = p;
+            bestDevice = dev;
+            bestScore = score;
+        }
+    }
+    if (!bestDevice)
+        return false;
+
+    cl_context_properties contextProps[] = { CL_CONTEXT_PLATFORM, (cl_context_properties) bestPlatform, 0 };
+    cl_int err;
+    context = clCreateContext(contextProps, 1, &bestDevice, 0, 0, &err);
+    if (!context) {
+        qWarning("Failed to create OpenCL context: %d", err);
+        return false;
+    }
+    platform = bestPlatform;
+    device = bestDevice;
     return true;
 }
 
@@ -291,6 +708,8 @@ bool QQuickCLContext::create()
 void QQuickCLContext::destroy()
 {
     Q_D(QQuickCLContext);
+    d->buildPool.waitForDone();
+    clearProgramCache();
     if (d->context) {
         qCDebug(logCL, "Releasing OpenCL context %p", d->context);
         clReleaseContext(d->context);
@@ -298,6 +717,23 @@ void QQuickCLContext::destroy()
     }
     d->device = 0;
     d->platform = 0;
+    d->deviceIdentity.clear();
+    d->deviceVersion = 0;
+    d->glInterop = false;
+}
+
+/*!
+    \return \c true if the context was created with CL-GL interop enabled.
+
+    When interop is not available, OpenCL memory objects cannot be created
+    from OpenGL textures or buffers. QQuickCLImageRunnable handles this
+    transparently, other QQuickCLRunnable implementations may need to check
+    this.
+ */
+bool QQuickCLContext::isGLInteropEnabled() const
+{
+    Q_D(const QQuickCLContext);
+    return d->glInterop;
 }
 
 /*!
@@ -339,8 +775,17 @@ QByteArray QQuickCLContext::deviceExtensions() const
 /*!
     Creates and builds an OpenCL program from the source code in \a src.
 
+    When the same source was built before, the cached program is returned
+    with its reference count increased. Otherwise, when a binary built from
+    the same source for the same device is found in the program binary cache,
+    the program is created from the cached binary instead of compiling the
+    source again.
+
     \return the cl_program or \c 0 when failed. Errors and build logs are
-    printed to the warning output.
+    printed to the warning output. The caller owns a reference to the
+    returned program and must release it with clReleaseProgram().
+
+    This function is thread safe.
 
     \note The value is valid only after create() has been called successfully.
 
@@ -353,31 +798,188 @@ QByteArray QQuickCLContext::deviceExtensions() const
  */
 cl_program QQuickCLContext::buildProgram(const QByteArray &src)
 {
+    Q_D(QQuickCLContext);
+    return d->buildProgram(src, QByteArray());
+}
+
+/*!
+    \overload
+
+    Creates and builds an OpenCL program from the source code in \a src,
+    passing \a options and the preprocessor \a defines to clBuildProgram().
+
+    Each distinct combination of options and defines results in a separate
+    program variant in the program cache.
+
+    \sa buildOptions()
+ */
+cl_program QQuickCLContext::buildProgram(const QByteArray &src, const QByteArray &options,
+                                         const DefineMap &defines)
+{
+    Q_D(QQuickCLContext);
+    return d->buildProgram(src, buildOptions(options, defines));
+}
+
+// The time spent on a cache miss is stored in buildTime, when given, and
+// otherwise accounted to the item being updated on the calling thread.
+cl_program QQuickCLContextPrivate::buildProgram(const QByteArray &src, const QByteArray &options,
+                                                double *buildTime)
+{
+    const QByteArray key = programCacheKey(src, options);
+
+    QMutexLocker lock(&programMutex);
+    cl_program prog = programs.value(key);
+    if (prog) {
+        clRetainProgram(prog);
+        return prog;
+    }
+    lock.unlock();
+
+    // Build without holding the lock so that unrelated programs can be built
+    // in parallel. Should somebody else have built the same program in the
+    // meantime, theirs wins.
+    QElapsedTimer timer;
+    timer.start();
+    prog = compileProgram(src, options, key);
+    const double ms = double(timer.nsecsElapsed()) / 1000000.0;
+    if (buildTime)
+        *buildTime = ms;
+    else if (QQuickCLStats *stats = QQuickCLStatsPrivate::current())
+        stats->addBuildTime(ms);
+    if (!prog)
+        return 0;
+
+    lock.relock();
+    cl_program existing = programs.value(key);
+    if (existing) {
+        clReleaseProgram(prog);
+        prog = existing;
+    } else {
+        programs.insert(key, prog);
+    }
+    clRetainProgram(prog);
+    return prog;
+}
+
+cl_program QQuickCLContextPrivate::compileProgram(const QByteArray &src, const QByteArray &options, const QByteArray &key)
+{
+    const QString cacheDir = programCacheDir();
+    QString cacheFileName;
+    if (!cacheDir.isEmpty()) {
+        cacheFileName = cacheDir + QLatin1Char('/') + QLatin1String(key);
+        cl_program prog = loadProgramBinary(cacheFileName, options);
+        if (prog) {
+            qCDebug(logCL, "Loaded program binary from %s", qPrintable(cacheFileName));
+            return prog;
+        }
+    }
+
     cl_int err;
     const char *str = src.constData();
-    cl_program prog = clCreateProgramWithSource(context(), 1, &str, 0, &err);
+    cl_program prog = clCreateProgramWithSource(context, 1, &str, 0, &err);
     if (!prog) {
         qWarning("Failed to create OpenCL program: %d", err);
         qWarning("Source was:\n%s", str);
         return 0;
     }
-    cl_device_id dev = device();
-    err = clBuildProgram(prog, 1, &dev, 0, 0, 0);
+    err = clBuildProgram(prog, 1, &device, options.isEmpty() ? 0 : options.constData(), 0, 0);
     if (err != CL_SUCCESS) {
         qWarning("Failed to build OpenCL program: %d", err);
         qWarning("Source was:\n%s", str);
         QByteArray log;
         log.resize(8192);
-        clGetProgramBuildInfo(prog, dev, CL_PROGRAM_BUILD_LOG, log.size(), log.data(), 0);
+        clGetProgramBuildInfo(prog, device, CL_PROGRAM_BUILD_LOG, log.size(), log.data(), 0);
         qWarning("Build log:\n%s", log.constData());
+        clReleaseProgram(prog);
         return 0;
     }
+
+    if (!cacheFileName.isEmpty())
+        saveProgramBinary(cacheFileName, prog);
+
     return prog;
 }
 
+QByteArray QQuickCLContextPrivate::programCacheKey(const QByteArray &src, const QByteArray &options) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(programBinaryMagic, programBinaryMagicSize);
+    hash.addData(deviceIdentity);
+    hash.addData("\0", 1);
+    hash.addData(options);
+    hash.addData("\0", 1);
+    hash.addData(src);
+    return hash.result().toHex();
+}
+
+cl_program QQuickCLContextPrivate::loadProgramBinary(const QString &fileName, const QByteArray &options)
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly))
+        return 0;
+    const QByteArray data = f.readAll();
+    if (data.size() <= programBinaryMagicSize || !data.startsWith(programBinaryMagic)) {
+        qCDebug(logCL, "Ignoring invalid program binary %s", qPrintable(fileName));
+        return 0;
+    }
+
+    const size_t size = data.size() - programBinaryMagicSize;
+    const unsigned char *binary = reinterpret_cast<const unsigned char *>(data.constData()) + programBinaryMagicSize;
+    cl_int binaryStatus = CL_SUCCESS;
+    cl_int err;
+    cl_program prog = clCreateProgramWithBinary(context, 1, &device, &size, &binary, &binaryStatus, &err);
+    if (!prog || binaryStatus != CL_SUCCESS) {
+        qCDebug(logCL, "Failed to create program from binary %s: %d %d", qPrintable(fileName), err, binaryStatus);
+        if (prog)
+            clReleaseProgram(prog);
+        return 0;
+    }
+    err = clBuildProgram(prog, 1, &device, options.isEmpty() ? 0 : options.constData(), 0, 0);
+    if (err != CL_SUCCESS) {
+        qCDebug(logCL, "Failed to build program from binary %s: %d", qPrintable(fileName), err);
+        clReleaseProgram(prog);
+        return 0;
+    }
+    return prog;
+}
+
+void QQuickCLContextPrivate::saveProgramBinary(const QString &fileName, cl_program prog)
+{
+    size_t size = 0;
+    cl_int err = clGetProgramInfo(prog, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, 0);
+    if (err != CL_SUCCESS || !size) {
+        qCDebug(logCL, "No program binary available for caching: %d", err);
+        return;
+    }
+    QByteArray binary(int(size), Qt::Uninitialized);
+    unsigned char *p = reinterpret_cast<unsigned char *>(binary.data());
+    err = clGetProgramInfo(prog, CL_PROGRAM_BINARIES, sizeof(unsigned char *), &p, 0);
+    if (err != CL_SUCCESS) {
+        qWarning("Failed to get program binary: %d", err);
+        return;
+    }
+
+    // QSaveFile writes to a temporary file and renames it on commit, so other
+    // processes either see the old file or the complete new one.
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly)) {
+        qWarning("Failed to open %s for writing the program binary", qPrintable(fileName));
+        return;
+    }
+    f.write(programBinaryMagic, programBinaryMagicSize);
+    f.write(binary);
+    if (!f.commit())
+        qWarning("Failed to write program binary to %s", qPrintable(fileName));
+    else
+        qCDebug(logCL, "Saved program binary to %s", qPrintable(fileName));
+}
+
 /*!
     Creates and builds an OpenCL program from the source file \a filename.
 
+    Like buildProgram(), this makes use of the program binary cache.
+
     \note The value is valid only after create() has been called successfully.
 
     \note For contexts belonging to a QQuickCLItem this function can only be
@@ -397,6 +999,245 @@ cl_program QQuickCLContext::buildProgramFromFile(const QString &filename)
     return buildProgram(f.readAll());
 }
 
+/*!
+    \overload
+
+    Creates and builds an OpenCL program from the source file \a filename,
+    passing \a options and the preprocessor \a defines to clBuildProgram().
+ */
+cl_program QQuickCLContext::buildProgramFromFile(const QString &filename, const QByteArray &options,
+                                                 const DefineMap &defines)
+{
+    QFile f(filename);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning("Failed to open OpenCL program source file %s", qPrintable(filename));
+        return 0;
+    }
+    return buildProgram(f.readAll(), options, defines);
+}
+
+/*!
+    \return the build options string passed to clBuildProgram() when building
+    with \a options and \a defines. Each define is appended as
+    \c{-D name=value}, or \c{-D name} when the value is empty.
+ */
+QByteArray QQuickCLContext::buildOptions(const QByteArray &options, const DefineMap &defines)
+{
+    QByteArray result = options.trimmed();
+    for (DefineMap::const_iterator it = defines.constBegin(); it != defines.constEnd(); ++it) {
+        if (!result.isEmpty())
+            result += ' ';
+        result += "-D " + it.key();
+        if (!it.value().isEmpty())
+            result += '=' + it.value();
+    }
+    return result;
+}
+
+/*!
+    \return a QQuickCLContext shared between all users of the current OpenGL
+    context's share group. The context is created on first use and is
+    reference counted: each successful call must be balanced by a call to
+    releaseShared().
+
+    Windows with OpenGL contexts sharing resources with each other, for
+    example because Qt::AA_ShareOpenGLContexts is set, get the same instance.
+    When no OpenGL context is current, a context without CL-GL interop is
+    returned, shared by all callers without a current OpenGL context.
+
+    The context is created with the default device selector.
+
+    This function is thread safe.
+
+    \return \c null if creating the OpenCL context failed.
+
+    \sa releaseShared(), defaultDeviceSelector()
+ */
+QQuickCLContext *QQuickCLContext::acquireShared()
+{
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    QOpenGLContextGroup *shareGroup = ctx ? ctx->shareGroup() : 0;
+
+    QMutexLocker lock(sharedContextMutex());
+    QQuickCLContext *clctx = sharedContexts()->value(shareGroup);
+    if (clctx) {
+        ++clctx->d_func()->sharedRef;
+        return clctx;
+    }
+
+    qCDebug(logCL, "Creating shared OpenCL context for share group %p", shareGroup);
+    clctx = new QQuickCLContext;
+    if (!clctx->create()) {
+        delete clctx;
+        return 0;
+    }
+    clctx->d_func()->shareGroup = shareGroup;
+    clctx->d_func()->sharedRef = 1;
+    sharedContexts()->insert(shareGroup, clctx);
+    return clctx;
+}
+
+/*!
+    Drops a reference to the shared \a context retrieved from acquireShared().
+    The context is destroyed when the last reference is dropped.
+
+    This function is thread safe.
+
+    \sa acquireShared()
+ */
+void QQuickCLContext::releaseShared(QQuickCLContext *context)
+{
+    if (!context)
+        return;
+
+    QMutexLocker lock(sharedContextMutex());
+    QQuickCLContextPrivate *d = context->d_func();
+    Q_ASSERT(d->sharedRef > 0);
+    if (--d->sharedRef > 0)
+        return;
+    sharedContexts()->remove(d->shareGroup);
+    lock.unlock();
+
+    qCDebug(logCL, "Last reference to shared OpenCL context %p dropped", d->context);
+    delete context;
+}
+
+/*!
+    Starts building an OpenCL program from the source code in \a src on a
+    worker thread and returns immediately.
+
+    The build goes through the same program cache as buildProgram(). When
+    \a item is not \c null, \l{QQuickCLItem::scheduleUpdate()}{scheduleUpdate()}
+    is called on it on the gui thread once the build has finished, unless the
+    item has been destroyed in the meantime. This allows a QQuickCLRunnable to
+    keep showing the previous content, or nothing, until the program is ready,
+    instead of blocking the render thread.
+
+    \note The context waits for all pending builds to finish in destroy().
+
+    \sa QQuickCLProgramBuild, buildProgram(), QQuickCLImageRunnable::addProgramBuild()
+ */
+QQuickCLProgramBuild QQuickCLContext::buildProgramAsync(const QByteArray &src, QQuickCLItem *item)
+{
+    return buildProgramAsync(src, QByteArray(), DefineMap(), item);
+}
+
+/*!
+    \overload
+
+    Starts building an OpenCL program from the source code in \a src with the
+    build \a options and preprocessor \a defines on a worker thread. When
+    \a item is not \c null, it is updated once the build has finished.
+ */
+QQuickCLProgramBuild QQuickCLContext::buildProgramAsync(const QByteArray &src, const QByteArray &options,
+                                                        const DefineMap &defines, QQuickCLItem *item)
+{
+    Q_D(QQuickCLContext);
+    QQuickCLProgramBuild build;
+    build.d.reset(new QQuickCLProgramBuildPrivate);
+    build.d->src = src;
+    build.d->options = buildOptions(options, defines);
+    build.d->notifier = item ? new ProgramBuildNotifier(item) : 0;
+    d->buildPool.start(new ProgramBuildRunnable(d, build.d));
+    return build;
+}
+
+/*!
+    \return the device selector used by create() and acquireShared().
+
+    Unless changed via setDefaultDeviceSelector(), this is the selector parsed
+    from the \c QT_QUICKCL_DEVICE environment variable, or a
+    default-constructed QQuickCLDeviceSelector when the variable is not set.
+
+    This function is thread safe.
+ */
+QQuickCLDeviceSelector QQuickCLContext::defaultDeviceSelector()
+{
+    DefaultDeviceSelector *d = defaultSelector();
+    QMutexLocker lock(&d->mutex);
+    if (!d->initialized) {
+        d->selector = QQuickCLDeviceSelector::fromString(qgetenv("QT_QUICKCL_DEVICE"));
+        d->initialized = true;
+    }
+    return d->selector;
+}
+
+/*!
+    Sets the default device \a selector, overriding \c QT_QUICKCL_DEVICE.
+
+    \note Shared contexts that have already been created are not affected.
+ */
+void QQuickCLContext::setDefaultDeviceSelector(const QQuickCLDeviceSelector &selector)
+{
+    DefaultDeviceSelector *d = defaultSelector();
+    QMutexLocker lock(&d->mutex);
+    d->selector = selector;
+    d->initialized = true;
+}
+
+/*!
+    Releases the references the context holds to the programs built via
+    buildProgram(). Programs that are still in use are not affected, but
+    building them again will trigger a new build (or binary cache lookup).
+
+    This is done automatically in destroy().
+ */
+void QQuickCLContext::clearProgramCache()
+{
+    Q_D(QQuickCLContext);
+    QMutexLocker lock(&d->programMutex);
+    foreach (cl_kernel kernel, d->kernelPrototypes)
+        clReleaseKernel(kernel);
+    d->kernelPrototypes.clear();
+    foreach (cl_program prog, d->programs)
+        clReleaseProgram(prog);
+    d->programs.clear();
+}
+
+/*!
+    Creates a new kernel object for the kernel function \a name in \a program.
+
+    Unlike the program, which is typically shared between all users of the
+    same source due to the program cache, kernel objects are stateful and
+    therefore must not be shared between items as their arguments may differ.
+    This function is a convenient way to get a kernel object for each user.
+    On OpenCL 2.1 and newer devices the kernels are created by cloning a
+    prototype kernel via clCloneKernel().
+
+    \return the new kernel or \c 0 when failed. The caller must release it
+    with clReleaseKernel().
+
+    This function is thread safe.
+ */
+cl_kernel QQuickCLContext::createKernel(cl_program program, const QByteArray &name)
+{
+    Q_D(QQuickCLContext);
+    cl_int err;
+#ifdef CL_VERSION_2_1
+    if (d->deviceVersion >= 201) {
+        QMutexLocker lock(&d->programMutex);
+        const QPair<cl_program, QByteArray> key(program, name);
+        cl_kernel prototype = d->kernelPrototypes.value(key);
+        if (!prototype) {
+            prototype = clCreateKernel(program, name.constData(), &err);
+            if (!prototype) {
+                qWarning("Failed to create OpenCL kernel %s: %d", name.constData(), err);
+                return 0;
+            }
+            d->kernelPrototypes.insert(key, prototype);
+        }
+        cl_kernel kernel = clCloneKernel(prototype, &err);
+        if (kernel)
+            return kernel;
+        qCDebug(logCL, "Failed to clone kernel %s: %d", name.constData(), err);
+    }
+#endif
+    cl_kernel kernel = clCreateKernel(program, name.constData(), &err);
+    if (!kernel)
+        qWarning("Failed to create OpenCL kernel %s: %d", name.constData(), err);
+    return kernel;
+}
+
 /*!
     Returns a matching OpenCL image format for the given QImage \a format.
  */
@@ -458,4 +1299,287 @@ cl_image_format QQuickCLContext::toCLImageFormat(QImage::Format format)
     return fmt;
 }
 
+/*!
+    Returns the OpenCL image format matching the OpenGL texture \a format.
+    This is the format of OpenCL image objects created from textures with the
+    given internal format.
+ */
+cl_image_format QQuickCLContext::toCLImageFormat(QOpenGLTexture::TextureFormat format)
+{
+    cl_image_format fmt;
+
+    switch (format) {
+    case QOpenGLTexture::R8_UNorm:
+        fmt.image_channel_order = CL_R;
+        fmt.image_channel_data_type = CL_UNORM_INT8;
+        break;
+
+    case QOpenGLTexture::RG8_UNorm:
+        fmt.image_channel_order = CL_RG;
+        fmt.image_channel_data_type = CL_UNORM_INT8;
+        break;
+
+    case QOpenGLTexture::RGBA8_UNorm:
+        fmt.image_channel_order = CL_RGBA;
+        fmt.image_channel_data_type = CL_UNORM_INT8;
+        break;
+
+    case QOpenGLTexture::R16F:
+        fmt.image_channel_order = CL_R;
+        fmt.image_channel_data_type = CL_HALF_FLOAT;
+        break;
+
+    case QOpenGLTexture::RG16F:
+        fmt.image_channel_order = CL_RG;
+        fmt.image_channel_data_type = CL_HALF_FLOAT;
+        break;
+
+    case QOpenGLTexture::RGBA16F:
+        fmt.image_channel_order = CL_RGBA;
+        fmt.image_channel_data_type = CL_HALF_FLOAT;
+        break;
+
+    case QOpenGLTexture::R32F:
+        fmt.image_channel_order = CL_R;
+        fmt.image_channel_data_type = CL_FLOAT;
+        break;
+
+    case QOpenGLTexture::RG32F:
+        fmt.image_channel_order = CL_RG;
+        fmt.image_channel_data_type = CL_FLOAT;
+        break;
+
+    case QOpenGLTexture::RGBA32F:
+        fmt.image_channel_order = CL_RGBA;
+        fmt.image_channel_data_type = CL_FLOAT;
+        break;
+
+    default:
+        qWarning("toCLImageFormat: Unrecognized texture format 0x%x", format);
+        fmt.image_channel_order = 0;
+        fmt.image_channel_data_type = 0;
+        break;
+    }
+
+    return fmt;
+}
+
+/*!
+    \class QQuickCLDeviceSelector
+
+    \brief QQuickCLDeviceSelector describes how QQuickCLContext chooses the
+    OpenCL platform and device.
+
+    Devices are filtered by type and by case insensitive substrings of the
+    platform and device names. When CL-GL interop is preferred and an OpenGL
+    context is current, the device used by the OpenGL implementation wins,
+    provided it passes the filters. Otherwise the first suitable device is
+    chosen, or, with the FastestDevice policy, the one with the highest number
+    of compute units multiplied by the maximum clock frequency.
+
+    \value FirstDevice Choose the first suitable device.
+    \value FastestDevice Choose the suitable device with the highest estimated throughput.
+ */
+
+/*!
+    Constructs a selector preferring a GPU device with CL-GL interop.
+ */
+QQuickCLDeviceSelector::QQuickCLDeviceSelector()
+    : m_deviceType(0),
+      m_policy(FirstDevice),
+      m_interop(true)
+{
+}
+
+/*!
+    \return the device type mask. The default, \c 0, means that GPUs are
+    preferred but any other type of device is accepted when there is no GPU.
+ */
+cl_device_type QQuickCLDeviceSelector::deviceType() const
+{
+    return m_deviceType;
+}
+
+/*!
+    Sets the accepted device \a type mask, for example \c CL_DEVICE_TYPE_CPU.
+ */
+void QQuickCLDeviceSelector::setDeviceType(cl_device_type type)
+{
+    m_deviceType = type;
+}
+
+/*!
+    \return the platform name pattern.
+ */
+QByteArray QQuickCLDeviceSelector::platformName() const
+{
+    return m_platformName;
+}
+
+/*!
+    Accept only platforms whose name contains \a pattern, ignoring case. An
+    empty pattern accepts all platforms.
+ */
+void QQuickCLDeviceSelector::setPlatformName(const QByteArray &pattern)
+{
+    m_platformName = pattern;
+}
+
+/*!
+    \return the device name pattern.
+ */
+QByteArray QQuickCLDeviceSelector::deviceName() const
+{
+    return m_deviceName;
+}
+
+/*!
+    Accept only devices whose name contains \a pattern, ignoring case. An
+    empty pattern accepts all devices.
+ */
+void QQuickCLDeviceSelector::setDeviceName(const QByteArray &pattern)
+{
+    m_deviceName = pattern;
+}
+
+/*!
+    \return the policy for choosing between multiple suitable devices.
+ */
+QQuickCLDeviceSelector::Policy QQuickCLDeviceSelector::policy() const
+{
+    return m_policy;
+}
+
+/*!
+    Sets the \a policy for choosing between multiple suitable devices.
+ */
+void QQuickCLDeviceSelector::setPolicy(Policy policy)
+{
+    m_policy = policy;
+}
+
+/*!
+    \return \c true if the device matching the current OpenGL context is
+    preferred in order to enable CL-GL interop. The default is \c true.
+ */
+bool QQuickCLDeviceSelector::isInteropPreferred() const
+{
+    return m_interop;
+}
+
+/*!
+    Sets whether CL-GL interop is \a preferred. When disabled, the OpenCL
+    context is created without interop even if it would be available.
+ */
+void QQuickCLDeviceSelector::setInteropPreferred(bool preferred)
+{
+    m_interop = preferred;
+}
+
+/*!
+    Creates a selector from the string \a spec, which is a comma separated
+    list of the following:
+
+    \list
+    \li \c gpu, \c cpu, \c accelerator, \c all - accepted device types
+    \li \c platform=<pattern> - platform name pattern
+    \li \c device=<pattern> - device name pattern
+    \li \c fastest - use the FastestDevice policy
+    \li \c nointerop - do not prefer CL-GL interop
+    \endlist
+
+    For example, \c{cpu,platform=portable} selects the CPU device of POCL.
+
+    This is the format of the \c QT_QUICKCL_DEVICE environment variable.
+ */
+QQuickCLDeviceSelector QQuickCLDeviceSelector::fromString(const QByteArray &spec)
+{
+    QQuickCLDeviceSelector selector;
+    cl_device_type type = 0;
+    foreach (const QByteArray &token, spec.split(',')) {
+        const QByteArray value = token.trimmed();
+        const QByteArray lowerValue = value.toLower();
+        if (value.isEmpty())
+            continue;
+        if (lowerValue == "gpu")
+            type |= CL_DEVICE_TYPE_GPU;
+        else if (lowerValue == "cpu")
+            type |= CL_DEVICE_TYPE_CPU;
+        else if (lowerValue == "accelerator")
+            type |= CL_DEVICE_TYPE_ACCELERATOR;
+        else if (lowerValue == "all")
+            type |= CL_DEVICE_TYPE_ALL;
+        else if (lowerValue == "fastest")
+            selector.setPolicy(FastestDevice);
+        else if (lowerValue == "nointerop")
+            selector.setInteropPreferred(false);
+        else if (lowerValue.startsWith("platform="))
+            selector.setPlatformName(value.mid(9));
+        else if (lowerValue.startsWith("device="))
+            selector.setDeviceName(value.mid(7));
+        else
+            qWarning("Ignoring unknown OpenCL device selector option '%s'", value.constData());
+    }
+    selector.setDeviceType(type);
+    return selector;
+}
+
+/*!
+    \class QQuickCLProgramBuild
+
+    \brief QQuickCLProgramBuild is a handle to an asynchronous program build
+    started via QQuickCLContext::buildProgramAsync().
+
+    The handle is cheap to copy. All copies refer to the same build.
+ */
+
+/*!
+    Constructs a null handle.
+ */
+QQuickCLProgramBuild::QQuickCLProgramBuild()
+{
+}
+
+/*!
+    \return \c true if this handle does not refer to a build.
+ */
+bool QQuickCLProgramBuild::isNull() const
+{
+    return d.isNull();
+}
+
+/*!
+    \return \c true if the build has finished, regardless of it being
+    successful or not. This function never blocks.
+ */
+bool QQuickCLProgramBuild::isFinished() const
+{
+    return d && d->finished.loadAcquire();
+}
+
+/*!
+    Blocks until the build has finished.
+ */
+void QQuickCLProgramBuild::waitForFinished()
+{
+    if (!d)
+        return;
+    QMutexLocker lock(&d->mutex);
+    while (!d->finished.load())
+        d->finishedCondition.wait(&d->mutex);
+}
+
+/*!
+    \return the built program or \c 0 if the build has not yet finished or
+    has failed.
+
+    \note The program is owned by the handle and gets released when the last
+    copy of the handle is destroyed. Call clRetainProgram() to keep it alive
+    for longer.
+ */
+cl_program QQuickCLProgramBuild::program() const
+{
+    return isFinished() ? d->program : 0;
+}
+
 QT_END_NAMESPACE
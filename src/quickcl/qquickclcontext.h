@@ -39,10 +39,66 @@
 
 #include <QtQuickCL/qtquickclglobal.h>
 #include <QtGui/qimage.h>
+#include <QtGui/qopengltexture.h>
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qmap.h>
 
 QT_BEGIN_NAMESPACE
 
 class QQuickCLContextPrivate;
+class QQuickCLProgramBuildPrivate;
+class QQuickCLItem;
+
+class Q_QUICKCL_EXPORT QQuickCLProgramBuild
+{
+public:
+    QQuickCLProgramBuild();
+
+    bool isNull() const;
+    bool isFinished() const;
+    void waitForFinished();
+
+    cl_program program() const;
+
+private:
+    friend class QQuickCLContext;
+    QSharedPointer<QQuickCLProgramBuildPrivate> d;
+};
+
+class Q_QUICKCL_EXPORT QQuickCLDeviceSelector
+{
+public:
+    enum Policy {
+        FirstDevice,
+        FastestDevice
+    };
+
+    QQuickCLDeviceSelector();
+
+    cl_device_type deviceType() const;
+    void setDeviceType(cl_device_type type);
+
+    QByteArray platformName() const;
+    void setPlatformName(const QByteArray &pattern);
+
+    QByteArray deviceName() const;
+    void setDeviceName(const QByteArray &pattern);
+
+    Policy policy() const;
+    void setPolicy(Policy policy);
+
+    bool isInteropPreferred() const;
+    void setInteropPreferred(bool preferred);
+
+    static QQuickCLDeviceSelector fromString(const QByteArray &spec);
+
+private:
+    cl_device_type m_deviceType;
+    QByteArray m_platformName;
+    QByteArray m_deviceName;
+    Policy m_policy;
+    bool m_interop;
+};
 
 class Q_QUICKCL_EXPORT QQuickCLContext
 {
@@ -53,9 +109,11 @@ public:
     ~QQuickCLContext();
 
     bool create();
+    bool create(const QQuickCLDeviceSelector &selector);
     void destroy();
 
     bool isValid() const;
+    bool isGLInteropEnabled() const;
 
     cl_platform_id platform() const;
     cl_device_id device() const;
@@ -64,10 +122,30 @@ public:
     QByteArray platformName() const;
     QByteArray deviceExtensions() const;
 
+    typedef QMap<QByteArray, QByteArray> DefineMap;
+
     cl_program buildProgram(const QByteArray &src);
+    cl_program buildProgram(const QByteArray &src, const QByteArray &options,
+                            const DefineMap &defines = DefineMap());
     cl_program buildProgramFromFile(const QString &filename);
+    cl_program buildProgramFromFile(const QString &filename, const QByteArray &options,
+                                    const DefineMap &defines = DefineMap());
+    QQuickCLProgramBuild buildProgramAsync(const QByteArray &src, QQuickCLItem *item = 0);
+    QQuickCLProgramBuild buildProgramAsync(const QByteArray &src, const QByteArray &options,
+                                           const DefineMap &defines, QQuickCLItem *item = 0);
+    static QByteArray buildOptions(const QByteArray &options, const DefineMap &defines);
+    void clearProgramCache();
+
+    cl_kernel createKernel(cl_program program, const QByteArray &name);
 
     static cl_image_format toCLImageFormat(QImage::Format format);
+    static cl_image_format toCLImageFormat(QOpenGLTexture::TextureFormat format);
+
+    static QQuickCLDeviceSelector defaultDeviceSelector();
+    static void setDefaultDeviceSelector(const QQuickCLDeviceSelector &selector);
+
+    static QQuickCLContext *acquireShared();
+    static void releaseShared(QQuickCLContext *context);
 
 private:
     QQuickCLContextPrivate *d_ptr;
@@ -0,0 +1,408 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qquickclglsync.h"
+#include "qquickclcontext.h"
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QVector>
+#include <QtCore/QPair>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLFunctions>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(logCL)
+
+/*!
+    \class QQuickCLGLSync
+
+    \brief QQuickCLGLSync synchronizes OpenCL and OpenGL work on shared objects
+    with the cheapest method available.
+
+    Before OpenCL can access OpenGL objects, the OpenGL commands operating on
+    them must have finished, and vice versa. Without any extensions this
+    requires a glFinish() before clEnqueueAcquireGLObjects() and a clFinish()
+    after clEnqueueReleaseGLObjects(), both stalling the render thread until
+    the entire pipeline has drained. QQuickCLGLSync picks a narrower method
+    for each direction, depending on the available extensions:
+
+    OpenGL to OpenCL, see acquireFromGL():
+    \list
+    \li \c SyncObject - With \c cl_khr_gl_event and OpenGL sync objects, a
+    fence is inserted into the OpenGL command stream and turned into an OpenCL
+    event via \c clCreateEventFromGLsyncKHR(). The acquire waits for this
+    event on the device, the CPU is not blocked.
+    \li \c Implicit - With \c cl_khr_gl_event but no OpenGL sync objects the
+    acquire synchronizes implicitly.
+    \li \c ClientWait - With OpenGL sync objects only, a fence is inserted and
+    polled until it has signaled. This waits only for the commands issued
+    before the fence, not for the entire pipeline.
+    \li \c Finish - glFinish().
+    \endlist
+
+    OpenCL to OpenGL, see releaseToGL():
+    \list
+    \li \c Implicit - With \c cl_khr_gl_event the release synchronizes
+    implicitly.
+    \li \c SyncObject - With \c GL_ARB_cl_event the release event is turned
+    into an OpenGL sync object and the OpenGL server waits for it via
+    glWaitSync(). The CPU is not blocked.
+    \li \c ClientWait - The queue is flushed and the CPU waits for the
+    release event only.
+    \li \c Finish - clFinish(), used when no release event is available.
+    \endlist
+
+    Instances are to be created and used on the render thread, with the
+    OpenGL context current, for example in the constructor and update() of a
+    QQuickCLRunnable. QQuickCLImageRunnable uses this class internally. Custom
+    runnables sharing OpenGL objects with OpenCL can use it as follows:
+
+    \badcode
+        cl_event glDone = m_sync->acquireFromGL();
+        clEnqueueAcquireGLObjects(queue, 1, &mem, glDone ? 1 : 0, glDone ? &glDone : 0, 0);
+        ... // enqueue kernels
+        cl_event released = 0;
+        clEnqueueReleaseGLObjects(queue, 1, &mem, 0, 0, &released);
+        m_sync->releaseToGL(released);
+        clReleaseEvent(released);
+    \endcode
+
+    \note This is only relevant with CL-GL interop. Without interop the
+    methods are always \c Finish.
+ */
+
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_TIMEOUT_EXPIRED
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#ifndef GL_WAIT_FAILED
+#define GL_WAIT_FAILED 0x911D
+#endif
+#ifndef GL_TIMEOUT_IGNORED
+#define GL_TIMEOUT_IGNORED 0xFFFFFFFFFFFFFFFFull
+#endif
+
+// GLsync is not available in OpenGL ES 2.0 headers. It is an opaque pointer.
+typedef void *GLSyncHandle;
+typedef GLSyncHandle (QOPENGLF_APIENTRYP FenceSyncFunc)(GLenum condition, GLbitfield flags);
+typedef GLenum (QOPENGLF_APIENTRYP ClientWaitSyncFunc)(GLSyncHandle sync, GLbitfield flags, quint64 timeout);
+typedef void (QOPENGLF_APIENTRYP WaitSyncFunc)(GLSyncHandle sync, GLbitfield flags, quint64 timeout);
+typedef void (QOPENGLF_APIENTRYP DeleteSyncFunc)(GLSyncHandle sync);
+typedef GLSyncHandle (QOPENGLF_APIENTRYP CreateSyncFromCLeventFunc)(cl_context context, cl_event event, GLbitfield flags);
+
+class QQuickCLGLSyncPrivate
+{
+public:
+    QQuickCLGLSyncPrivate(QQuickCLContext *context, cl_command_queue queue)
+        : context(context),
+          queue(queue),
+          glToCL(QQuickCLGLSync::Finish),
+          clToGL(QQuickCLGLSync::Finish),
+          fenceSync(0),
+          clientWaitSync(0),
+          waitSync(0),
+          deleteSync(0),
+          createSyncFromCLevent(0),
+#ifdef cl_khr_gl_event
+          createEventFromGLsync(0),
+#endif
+          blocked(0)
+    { }
+
+    void releaseCompleted(bool wait);
+
+    QQuickCLContext *context;
+    cl_command_queue queue;
+    QQuickCLGLSync::Method glToCL;
+    QQuickCLGLSync::Method clToGL;
+    FenceSyncFunc fenceSync;
+    ClientWaitSyncFunc clientWaitSync;
+    WaitSyncFunc waitSync;
+    DeleteSyncFunc deleteSync;
+    CreateSyncFromCLeventFunc createSyncFromCLevent;
+#ifdef cl_khr_gl_event
+    clCreateEventFromGLsyncKHR_fn createEventFromGLsync;
+#endif
+    // The fences must stay alive until the OpenCL events created from them
+    // have completed.
+    QVector<QPair<GLSyncHandle, cl_event> > pending;
+    // Nanoseconds the calling thread spent waiting, see takeBlockedTime().
+    qint64 blocked;
+};
+
+// Adds the lifetime of the instance to the total.
+class BlockingScope
+{
+public:
+    BlockingScope(qint64 *total) : total(total) { timer.start(); }
+    ~BlockingScope() { *total += timer.nsecsElapsed(); }
+
+private:
+    qint64 *total;
+    QElapsedTimer timer;
+};
+
+void QQuickCLGLSyncPrivate::releaseCompleted(bool wait)
+{
+    for (int i = pending.count() - 1; i >= 0; --i) {
+        cl_event event = pending[i].second;
+        cl_int status = CL_COMPLETE;
+        if (wait)
+            clWaitForEvents(1, &event);
+        else
+            clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, 0);
+        if (status == CL_COMPLETE || status < 0) {
+            clReleaseEvent(event);
+            deleteSync(pending[i].first);
+            pending.remove(i);
+        }
+    }
+}
+
+/*!
+    Creates a new instance for synchronizing the OpenCL command \a queue
+    belonging to \a context with the OpenGL context that is current on the
+    calling thread.
+ */
+QQuickCLGLSync::QQuickCLGLSync(QQuickCLContext *context, cl_command_queue queue)
+    : d_ptr(new QQuickCLGLSyncPrivate(context, queue))
+{
+    Q_D(QQuickCLGLSync);
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    if (!ctx || !context->isGLInteropEnabled())
+        return;
+
+    const QSurfaceFormat format = ctx->format();
+    const bool hasSync = ctx->isOpenGLES() ? format.majorVersion() >= 3
+                                           : (format.version() >= qMakePair(3, 2) || ctx->hasExtension(QByteArrayLiteral("GL_ARB_sync")));
+    if (hasSync) {
+        d->fenceSync = reinterpret_cast<FenceSyncFunc>(ctx->getProcAddress("glFenceSync"));
+        d->clientWaitSync = reinterpret_cast<ClientWaitSyncFunc>(ctx->getProcAddress("glClientWaitSync"));
+        d->waitSync = reinterpret_cast<WaitSyncFunc>(ctx->getProcAddress("glWaitSync"));
+        d->deleteSync = reinterpret_cast<DeleteSyncFunc>(ctx->getProcAddress("glDeleteSync"));
+        if (!d->fenceSync || !d->clientWaitSync || !d->waitSync || !d->deleteSync)
+            d->fenceSync = 0;
+    }
+
+    const bool hasCLEvent = context->deviceExtensions().contains(QByteArrayLiteral("cl_khr_gl_event"));
+    if (hasCLEvent) {
+        d->glToCL = Implicit;
+        d->clToGL = Implicit;
+#ifdef cl_khr_gl_event
+        if (d->fenceSync) {
+            d->createEventFromGLsync = (clCreateEventFromGLsyncKHR_fn) clGetExtensionFunctionAddress("clCreateEventFromGLsyncKHR");
+            if (d->createEventFromGLsync)
+                d->glToCL = SyncObject;
+        }
+#endif
+    } else {
+        if (d->fenceSync)
+            d->glToCL = ClientWait;
+        d->clToGL = ClientWait;
+    }
+
+    if (d->clToGL != Implicit && d->fenceSync && ctx->hasExtension(QByteArrayLiteral("GL_ARB_cl_event"))) {
+        d->createSyncFromCLevent = reinterpret_cast<CreateSyncFromCLeventFunc>(ctx->getProcAddress("glCreateSyncFromCLeventARB"));
+        if (d->createSyncFromCLevent)
+            d->clToGL = SyncObject;
+    }
+
+    qCDebug(logCL, "CL-GL synchronization: GL to CL %d, CL to GL %d", d->glToCL, d->clToGL);
+}
+
+/*!
+    Destroys the instance. Waits for pending synchronization events.
+ */
+QQuickCLGLSync::~QQuickCLGLSync()
+{
+    Q_D(QQuickCLGLSync);
+    d->releaseCompleted(true);
+    delete d_ptr;
+}
+
+/*!
+    Ensures that the OpenCL commands enqueued after this call see the results
+    of the OpenGL commands issued before. To be called right before
+    clEnqueueAcquireGLObjects().
+
+    \return an event the acquire must wait for, or \c 0 when no waiting is
+    needed. The event stays owned by QQuickCLGLSync and is valid until the next
+    call to this function.
+ */
+cl_event QQuickCLGLSync::acquireFromGL()
+{
+    Q_D(QQuickCLGLSync);
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+
+    switch (d->glToCL) {
+    case Implicit:
+        return 0;
+
+    case SyncObject:
+    {
+#ifdef cl_khr_gl_event
+        d->releaseCompleted(false);
+        GLSyncHandle fence = d->fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        f->glFlush();
+        cl_int err;
+        cl_event event = d->createEventFromGLsync(d->context->context(), cl_GLsync(fence), &err);
+        if (event) {
+            d->pending.append(qMakePair(fence, event));
+            return event;
+        }
+        qWarning("Failed to create OpenCL event from OpenGL sync object: %d", err);
+        d->deleteSync(fence);
+#endif
+        BlockingScope blocking(&d->blocked);
+        f->glFinish();
+        return 0;
+    }
+
+    case ClientWait:
+    {
+        BlockingScope blocking(&d->blocked);
+        GLSyncHandle fence = d->fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        // Poll with a short timeout, flushing on the first round.
+        GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        GLenum result;
+        do {
+            result = d->clientWaitSync(fence, flags, 1000000);
+            flags = 0;
+        } while (result == GL_TIMEOUT_EXPIRED);
+        d->deleteSync(fence);
+        if (result == GL_WAIT_FAILED)
+            f->glFinish();
+        return 0;
+    }
+
+    default:
+    {
+        BlockingScope blocking(&d->blocked);
+        f->glFinish();
+        return 0;
+    }
+    }
+}
+
+/*!
+    Ensures that the OpenGL commands issued after this call see the results of
+    the OpenCL commands enqueued before \a releaseEvent, which is the event
+    returned from clEnqueueReleaseGLObjects(). To be called right after
+    enqueuing the release. \a releaseEvent can be \c 0 when clToGLMethod() is
+    \c Implicit, otherwise passing \c 0 results in a clFinish().
+
+    When \a mode is \c DeferCompletion, the caller guarantees that the
+    OpenGL objects are not used before \a releaseEvent has completed, for
+    example by waiting for it via QQuickCLItem::watchEvent(). In this case
+    neither the CPU nor the OpenGL server waits, the queue is only flushed.
+
+    The caller keeps the ownership of \a releaseEvent.
+ */
+void QQuickCLGLSync::releaseToGL(cl_event releaseEvent, WaitMode mode)
+{
+    Q_D(QQuickCLGLSync);
+
+    if (d->clToGL == Implicit)
+        return;
+
+    if (releaseEvent && mode == DeferCompletion) {
+        // Even a server-side wait would stall all later OpenGL commands.
+        clFlush(d->queue);
+        return;
+    }
+
+    if (!releaseEvent) {
+        BlockingScope blocking(&d->blocked);
+        clFinish(d->queue);
+        return;
+    }
+
+    if (d->clToGL == SyncObject) {
+        // GL waits on the server side, the sync object can be deleted right
+        // away since deletion is deferred until the wait has completed.
+        clFlush(d->queue);
+        GLSyncHandle sync = d->createSyncFromCLevent(d->context->context(), releaseEvent, 0);
+        if (sync) {
+            d->waitSync(sync, 0, GL_TIMEOUT_IGNORED);
+            d->deleteSync(sync);
+            return;
+        }
+        qWarning("Failed to create OpenGL sync object from OpenCL event");
+    }
+
+    clFlush(d->queue);
+    BlockingScope blocking(&d->blocked);
+    clWaitForEvents(1, &releaseEvent);
+}
+
+/*!
+    \return the method used for making OpenCL wait for OpenGL.
+ */
+QQuickCLGLSync::Method QQuickCLGLSync::glToCLMethod() const
+{
+    Q_D(const QQuickCLGLSync);
+    return d->glToCL;
+}
+
+/*!
+    \return the method used for making OpenGL wait for OpenCL.
+ */
+QQuickCLGLSync::Method QQuickCLGLSync::clToGLMethod() const
+{
+    Q_D(const QQuickCLGLSync);
+    return d->clToGL;
+}
+
+/*!
+    \return the milliseconds the calling thread was blocked in glFinish(),
+    clFinish() or waiting for a sync object or event in acquireFromGL() and
+    releaseToGL() since the previous call, and resets the value.
+ */
+double QQuickCLGLSync::takeBlockedTime()
+{
+    Q_D(QQuickCLGLSync);
+    const double ms = double(d->blocked) / 1000000.0;
+    d->blocked = 0;
+    return ms;
+}
+
+QT_END_NAMESPACE
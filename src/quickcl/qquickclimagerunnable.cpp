@@ -35,15 +35,32 @@
 ****************************************************************************/
 
 #include "qquickclimagerunnable.h"
-#include "qquickclitem.h"
+#include "qquickclimagerunnable_p.h"
+#include "qquickclitem_p.h"
 #include "qquickclcontext.h"
+#include "qquickclglsync.h"
+#include "qquickcltracer.h"
+#include "qquickclstats.h"
 #include <QSGSimpleTextureNode>
 #include <QSGTextureProvider>
 #include <QOpenGLTexture>
 #include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QPointer>
+#include <QQuickItem>
+#include <QQuickWindow>
+#include <qmath.h>
+#include <QPair>
+#include <algorithm>
+#include <QLoggingCategory>
 
 QT_BEGIN_NAMESPACE
 
+Q_DECLARE_LOGGING_CATEGORY(logCL)
+
 /*!
     \class QQuickCLImageRunnable
     \brief A QQuickCLItem backend specialized for operating on a single texture from the scenegraph.
@@ -105,6 +122,167 @@ QT_BEGIN_NAMESPACE
     then done by child items since the QQuickCLItem itself does not render
     anything in the Qt Quick scenegraph in this case, although it is still
     present as an item having contents.
+
+    When CL-GL interop is not available, for example with CPU-based OpenCL
+    implementations, QQuickCLImageRunnable automatically falls back to
+    copying: the source texture is read back via glReadPixels() (using pixel
+    buffer objects where available), written into an OpenCL image allocated
+    with \c CL_MEM_ALLOC_HOST_PTR, which avoids additional copies on CPU
+    devices, and the output image is uploaded into the output texture
+    afterwards. The kernels need the source in the same frame, therefore the
+    readback is synchronous. The uploads alternate between two pixel buffers
+    so that an upload issued in one frame does not have to complete before the
+    next frame can fill a buffer. The input image passed to runKernel() is
+    always of the format \c CL_RGBA, \c CL_UNORM_INT8 in this mode, while the
+    output image follows setOutputFormat(). Otherwise the fallback is
+    transparent to runKernel().
+
+    \section1 Multi-stage pipelines
+
+    Instead of reimplementing runKernel(), subclasses can declare a graph of
+    kernel stages via addStage() and reimplement runStage(). Each stage
+    produces one image and reads the source image and/or the output of any
+    earlier stage. The final stage writes the output image, while the outputs
+    of the other stages are stored in intermediate images allocated by
+    QQuickCLImageRunnable. An intermediate image is recycled as soon as its
+    last consumer has been enqueued, so a linear chain of any length needs at
+    most two of them. All stages are executed between a single acquire and
+    release of the OpenGL textures. The format of the intermediate images is
+    \c CL_RGBA, \c CL_UNORM_INT8 by default and can be changed via
+    setIntermediateImageFormat().
+
+    For example, a blur, threshold and emboss pipeline is declared as follows:
+
+    \badcode
+        MyRunnable(QQuickCLItem *item) : QQuickCLImageRunnable(item) {
+            addStage(); // blur, reads the source image
+            addStage(); // threshold, reads the output of blur
+            addStage(); // emboss, reads the output of threshold
+            ...
+        }
+        void runStage(int stage, const QVector<cl_mem> &inputs, cl_mem outImage, const QSize &size) {
+            cl_kernel kernel = m_kernels[stage];
+            clSetKernelArg(kernel, 0, sizeof(cl_mem), &inputs[0]);
+            clSetKernelArg(kernel, 1, sizeof(cl_mem), &outImage);
+            ...
+        }
+    \endcode
+
+    \section1 State images
+
+    Temporal effects, like motion trails or running averages, need images that
+    survive between frames. Such images are registered via addStateImage().
+    They are owned by the runnable, allocated on first use with the size of
+    the source texture and are not affected by changes of the source texture
+    itself. When the size of the source texture changes, the images are
+    resized and their contents are handled according to the
+    StateImagePolicy: \c KeepContents preserves the overlapping region,
+    \c ClearContents zeroes the images, and \c RescaleContents resamples the
+    previous contents with bilinear filtering. The latter is only supported for
+    normalized and floating point formats.
+
+    A state image registered with \c pingPong set to \c true is backed by two
+    images. In runKernel() the previous state is read from stateImage() and the
+    new one is written to nextStateImage(). The two are swapped automatically
+    after runKernel() returns. For single state images both functions return
+    the same image.
+
+    \section1 Frames in flight
+
+    By default the results of a frame are shown in the same frame, which means
+    that the scenegraph has to wait for the OpenCL work before it can render
+    the output. For expensive kernels setFramesInFlight() allows trading
+    latency for throughput: with a depth of \c N the output is backed by a
+    ring of \c N textures. Each update enqueues the work for the new frame into
+    a free texture and shows the most recent result that has already
+    finished, so the kernels of one frame run while the previous results are
+    rendered. Once all textures are in use, update() waits for the oldest
+    frame in flight. When results finish while no further updates are
+    scheduled, the item is refreshed automatically.
+
+    In this mode new work is only enqueued when the source texture has changed
+    or when the item was updated via QQuickCLItem::scheduleUpdate(). Plain
+    \l{QQuickItem::update()}{updates} and refreshes that merely present
+    finished results do not run the kernels again. latency() reports how long
+    it took until the last shown result reached the screen, while elapsed()
+    reports the time spent executing OpenCL commands.
+
+    Sources that are rendered again for each frame, like layers, cannot be
+    updated while the frames in flight are still reading them. With such
+    sources update() waits for the previous frames before updating the
+    source, so only the OpenCL work of a frame and the rendering of the
+    scene overlap, and depths above 2 bring no further gain.
+
+    Pipelining requires CL-GL interop, with the copy fallback the depth is
+    always 1. Latency-sensitive items, for example ones that follow the mouse,
+    should keep the default depth of 1.
+
+    To avoid blocking the render thread while building OpenCL programs,
+    subclasses can use QQuickCLContext::buildProgramAsync() and register the
+    returned handle via addProgramBuild(). runKernel() is then not called until
+    all registered builds have finished.
+
+    \section1 Skipping unchanged frames
+
+    Items are often updated for reasons unrelated to the computation, for
+    example when their size changes. With the \c SkipUnchanged flag
+    runKernel() is only called when the inputs may have changed: when the
+    source texture was re-rendered, as reported by
+    QSGDynamicTexture::updateTexture() or QSGTextureProvider::textureChanged(),
+    when a different texture or size is provided, or when the item was updated
+    via QQuickCLItem::scheduleUpdate(), which is what property setters are
+    expected to call. Otherwise the previous output is shown again without
+    any OpenCL work, and elapsed() returns 0.
+
+    Runnables whose results depend on something else, like time, must call
+    QQuickCLItem::scheduleUpdate() to request new results.
+
+    \section1 Partial updates
+
+    When only a small part of a large source changes, for example a single
+    animated item in a layered subtree, processing the whole image wastes
+    most of the work. With the \c PartialUpdates flag the changed area is
+    collected from addDirtyRect() and from the items registered via
+    trackItemGeometry(), and the kernels only process that area, as reported
+    by dirtyRect(). Kernels enqueued via enqueueKernel() get the matching
+    global work offset and size. The rest of the output texture keeps the
+    previous results. Since layers do not report what has changed, source
+    texture changes that are not covered by the dirty rects are not
+    detected.
+
+    The whole image is processed when the item was updated via
+    QQuickCLItem::scheduleUpdate(), since property changes may affect every
+    pixel, when the source or the output texture changes, and when no dirty
+    area is known. Partial updates are not available with more than one frame
+    in flight, with ping-pong state images or with the \c NoOutputImage flag,
+    and require an OpenCL 1.1 device.
+
+    \section1 Working resolution
+
+    By default the kernels run at the size of the source texture, even when
+    the item is displayed much smaller. With the \c ScaleToItemSize flag the
+    working size is limited to the size of the item in device pixels. With
+    the \c AdaptiveResolution flag the execution time of each frame is
+    measured via profiling events and the working size is lowered whenever
+    the kernels take longer than the budget set via setFrameTimeBudget(),
+    and raised again once they take less than half of it.
+    resolutionScale() returns the current factor, which never goes below
+    minimumScale().
+
+    When the working size differs from the source size, the source is
+    downsampled before calling runKernel(), which receives the working size,
+    and the output is stretched to the item with linear filtering. State
+    images follow the working size according to their policy. Scaling
+    requires CL-GL interop and disables partial updates.
+
+    \section1 Statistics
+
+    The runnable reports the time spent acquiring and releasing the textures,
+    the time blocked waiting for OpenGL or OpenCL, the size of its images and
+    output textures and, with the \c Profile or \c AdaptiveResolution flag,
+    the execution time of each frame to the item's QQuickCLItem::clStats().
+    Updates arriving while a program build is still in progress are counted as
+    skipped frames.
  */
 
 /*!
@@ -114,14 +292,23 @@ QT_BEGIN_NAMESPACE
     run. \a inImage and \a outImage are ready to be used as input and output
     \c image2d_t parameters to a kernel. \a size specifies the size of the images.
 
+    The default implementation runs the stages added via addStage(). Subclasses
+    not using stages must reimplement this function.
+
+    \note Output textures are allocated in size classes so that they can be
+    reused when the size of the source changes. Therefore \a outImage may be
+    larger than \a size. Only the area specified by \a size is shown, kernels
+    should use \a size instead of querying the dimensions of \a outImage.
+
     \note For QQuickCLImageRunnable instances created with the NoImageOutput
     flag \a outImage is always \c 0.
 
-    \note QQuickCLImageRunnable is aware of \c cl_khr_gl_event and will invoke
-    glFinish() and clFinish() as necessary in case the extension is not
-    supported. Both will be omitted when the extension is present. However,
-    clFinish() is still invoked regardless of the presence of the extension when
-    either the \c ForceCLFinish or \c Profile flags are set.
+    \note The OpenGL and OpenCL work is synchronized via QQuickCLGLSync, which
+    avoids glFinish() and clFinish() whenever the \c cl_khr_gl_event,
+    \c GL_ARB_cl_event extensions or OpenGL sync objects are available.
+    However, clFinish() is still invoked when the \c ForceCLFinish flag is
+    set. The \c Profile flag does not affect synchronization, the profiling
+    results are collected once the frames have finished.
  */
 
 class QQuickCLImageRunnablePrivate
@@ -130,216 +317,2097 @@ public:
     QQuickCLImageRunnablePrivate(QQuickCLItem *item, QQuickCLImageRunnable::Flags flags)
         : item(item),
           flags(flags),
+          sourceTracker(new QQuickCLSourceTracker(item, QByteArrayLiteral("source"))),
           queue(0),
           inputTexture(0),
-          outputTexture(0),
-          elapsed(0)
+          outputFormatChanged(false),
+          elapsed(0),
+          sync(0),
+          interop(false),
+          resampleKernel(0),
+          usePixelBuffers(false),
+          readFbo(0),
+          copyFrame(0),
+          framesInFlight(1),
+          ringShown(-1),
+          ringSerial(0),
+          lastGeneration(0),
+          hasResult(false),
+          latency(0),
+          profilingQueue(false),
+          tracing(false),
+          traceTrack(-1),
+          cpuTrack(-1),
+          profileWindowSize(120),
+          profileNext(0),
+          stats(item->clStats()),
+          blockedTime(0),
+          dirtyMargin(0),
+          scaledInput(0),
+          frameBudget(8),
+          minScale(0.25),
+          scale(1),
+          kernelAverage(0),
+          governorCooldown(0)
     {
+        intermediateFormat.image_channel_order = CL_RGBA;
+        intermediateFormat.image_channel_data_type = CL_UNORM_INT8;
         image[0] = image[1] = 0;
+        output.texture = 0;
+        output.mem = 0;
+        outputFormat = QOpenGLTexture::RGBA8_UNorm;
         profEv[0] = profEv[1] = 0;
-        sourcePropertyName = QByteArrayLiteral("source");
+        packBuffer = 0;
+        unpackBuffer[0] = unpackBuffer[1] = 0;
+        if (qEnvironmentVariableIsSet("QT_QUICKCL_PROFILE"))
+            this->flags |= QQuickCLImageRunnable::Profile;
+        timer.start();
     }
 
     ~QQuickCLImageRunnablePrivate() {
-        if (image[0])
-            clReleaseMemObject(image[0]);
-        if (image[1])
-            clReleaseMemObject(image[1]);
+        // The item may already be gone.
+        stats = 0;
+        releaseImages();
+        foreach (const StateImage &st, stateImages) {
+            for (int i = 0; i < 2; ++i) {
+                if (st.image[i])
+                    clReleaseMemObject(st.image[i]);
+            }
+        }
+        if (resampleKernel)
+            clReleaseKernel(resampleKernel);
+        foreach (const InputImage &input, inputCache)
+            clReleaseMemObject(input.mem);
+        releaseOutputTexture(output);
+        foreach (const OutputTexture &t, outputPool)
+            releaseOutputTexture(t);
+        releaseRing();
+        harvestProfiling(true);
+        commitTraces();
+        delete sync;
+        delete sourceTracker;
         if (queue)
             clReleaseCommandQueue(queue);
-        delete outputTexture;
+        if (readFbo && QOpenGLContext::currentContext())
+            QOpenGLContext::currentContext()->functions()->glDeleteFramebuffers(1, &readFbo);
     }
 
+    struct InputImage {
+        QPointer<QSGTexture> source;
+        uint texture;
+        QSize size;
+        cl_mem mem;
+    };
+
+    struct OutputTexture {
+        GLuint texture;
+        QSize size;
+        cl_mem mem;
+    };
+
+    void releaseImages();
+    void releaseOutputs();
+    cl_mem inputImage(QSGTexture *texture, cl_int *err);
+    bool ensureOutputTexture(const QSize &size);
+    bool allocateOutputTexture(OutputTexture *t, const QSize &allocSize);
+    void releaseOutputTexture(const OutputTexture &t);
+    void padOutput(cl_mem mem, const QSize &size, const QSize &allocSize);
+    bool prepareCopy(QQuickCLContext *clctx);
+    bool copyFromTexture(uint texture);
+    bool copyToTexture();
+    cl_mem createIntermediateImage();
+    bool updateStateImages();
+    bool clearImage(cl_mem mem, const QSize &size);
+    bool resample(cl_mem src, cl_mem dst, const QSize &dstSize);
+
+    struct StateImage {
+        QQuickCLImageRunnable::StateImagePolicy policy;
+        bool pingPong;
+        cl_image_format format;
+        cl_mem image[2];
+        int current;
+        QSize size;
+    };
+
+    struct RingSlot {
+        OutputTexture output;
+        QSGTexture *texture;
+        cl_event done;
+        cl_event profEv[2];
+        QSize size;
+        qint64 submitted;
+        quint64 serial;
+    };
+
+    bool ensureRing(const QSize &size);
+    void releaseRing();
+    void harvestRing(bool wait);
+    int freeRingSlot();
+    QSGNode *updateNode(QSGNode *node);
+
+    struct PendingTrace {
+        QByteArray name;
+        cl_event begin;
+        cl_event end;
+        qint64 enqueued;
+    };
+
+    cl_event *traceEvent(const QByteArray &name);
+    void traceExistingEvent(const QByteArray &name, cl_event event, qint64 enqueued);
+    PendingTrace *beginTraceRange(const QByteArray &name);
+    void endTraceRange(PendingTrace *range);
+    void commitTraces();
+    void endFrameTrace(qint64 cpuStart);
+
+    void recordElapsed(cl_event start, cl_event end);
+    void harvestProfiling(bool wait);
+
+    void waitForEvent(cl_event event);
+    qint64 memoryUsage() const;
+    void reportFrameStats(double acquireTime, double releaseTime);
+
     QQuickCLItem *item;
     QQuickCLImageRunnable::Flags flags;
+    QQuickCLSourceTracker *sourceTracker;
     cl_command_queue queue;
     cl_mem image[2];
     QSize textureSize;
     uint inputTexture;
-    QOpenGLTexture *outputTexture;
-    QByteArray sourcePropertyName;
+    QList<InputImage> inputCache;
+    OutputTexture output;
+    QList<OutputTexture> outputPool;
+    QOpenGLTexture::TextureFormat outputFormat;
+    bool outputFormatChanged;
+    QVector<QQuickCLProgramBuild> pendingBuilds;
     cl_event profEv[2];
     double elapsed;
-    bool needsExplicitSync;
+    QQuickCLGLSync *sync;
+    bool interop;
+    QVector<QVector<int> > stages;
+    cl_image_format intermediateFormat;
+    QVector<cl_mem> intermediates;
+    QVector<StateImage> stateImages;
+    cl_kernel resampleKernel;
+
+    // Used only when CL-GL interop is not available.
+    bool usePixelBuffers;
+    GLuint readFbo;
+    QOpenGLBuffer *packBuffer;
+    QOpenGLBuffer *unpackBuffer[2];
+    QByteArray pixels;
+    int copyFrame;
+
+    // Used only when more than one frame is in flight.
+    int framesInFlight;
+    QVector<RingSlot> ring;
+    int ringShown;
+    quint64 ringSerial;
+    int lastGeneration;
+    bool hasResult;
+    QElapsedTimer timer;
+    double latency;
+
+    // Used only when QQuickCLTracer is enabled.
+    bool profilingQueue;
+    bool tracing;
+    int traceTrack;
+    int cpuTrack;
+    QList<PendingTrace *> pendingTraces;
+
+    // Used only with the Profile flag.
+    QList<QPair<cl_event, cl_event> > pendingProfiling;
+    QVector<double> profileWindow;
+    int profileWindowSize;
+    int profileNext;
+
+    QQuickCLStats *stats;
+    // Milliseconds spent waiting since the last reportFrameStats().
+    double blockedTime;
+
+    // Used only with the PartialUpdates flag.
+    struct TrackedItem {
+        QPointer<QQuickItem> item;
+        QRect rect;
+    };
+    QRect takeDirtyRect(const QSize &size);
+    bool hasPingPongState() const;
+
+    QMutex dirtyMutex;
+    QRect dirty;
+    QVector<TrackedItem> trackedItems;
+    int dirtyMargin;
+    // The areas processed in the current frame and stage, null when
+    // processing the whole image.
+    QRect frameRect;
+    QRect stageRect;
+
+    // Used only with ScaleToItemSize or AdaptiveResolution.
+    QSize workingSize(const QSize &sourceSize) const;
+    void adjustScale(double ms);
+
+    QSize sourceSize;
+    cl_mem scaledInput;
+    double frameBudget;
+    double minScale;
+    double scale;
+    double kernelAverage;
+    int governorCooldown;
 };
 
-/*!
-    Constructs a new QQuickCLImageRunnable instance associated with \a item.
-    Special behavior, for example computations producing arbitrary non-image
-    output, can be enabled via \a flags.
- */
-QQuickCLImageRunnable::QQuickCLImageRunnable(QQuickCLItem *item, Flags flags)
-    : d_ptr(new QQuickCLImageRunnablePrivate(item, flags))
+// With interop the images are owned by the input cache and the output
+// textures, otherwise they are plain OpenCL images of the source size.
+void QQuickCLImageRunnablePrivate::releaseImages()
 {
-    Q_D(QQuickCLImageRunnable);
-    cl_int err;
-    cl_command_queue_properties queueProps = flags.testFlag(Profile) ? CL_QUEUE_PROFILING_ENABLE : 0;
-    QQuickCLContext *clctx = item->context();
-    Q_ASSERT(clctx);
-    d->queue = clCreateCommandQueue(clctx->context(), clctx->device(), queueProps, &err);
-    if (!d->queue) {
-        qWarning("Failed to create OpenCL command queue: %d", err);
-        return;
+    delete packBuffer;
+    packBuffer = 0;
+    for (int i = 0; i < 2; ++i) {
+        if (image[i] && !interop)
+            clReleaseMemObject(image[i]);
+        image[i] = 0;
+        delete unpackBuffer[i];
+        unpackBuffer[i] = 0;
     }
-    d->needsExplicitSync = !clctx->deviceExtensions().contains(QByteArrayLiteral("cl_khr_gl_event"));
+    foreach (cl_mem mem, intermediates)
+        clReleaseMemObject(mem);
+    intermediates.clear();
+    if (scaledInput)
+        clReleaseMemObject(scaledInput);
+    scaledInput = 0;
 }
 
-QQuickCLImageRunnable::~QQuickCLImageRunnable()
+// Drops all output textures and images, they get recreated on the next
+// update. Must only be called from update() since the node may still
+// reference the textures.
+void QQuickCLImageRunnablePrivate::releaseOutputs()
 {
-    delete d_ptr;
+    releaseImages();
+    releaseOutputTexture(output);
+    output.texture = 0;
+    output.mem = 0;
+    foreach (const OutputTexture &t, outputPool)
+        releaseOutputTexture(t);
+    outputPool.clear();
+    releaseRing();
+    hasResult = false;
+    textureSize = QSize();
+    sourceSize = QSize();
 }
 
-/*!
-    \return the OpenCL command queue.
- */
-cl_command_queue QQuickCLImageRunnable::commandQueue() const
+// Layer textures and animated sources may switch between a few textures.
+// Keep the CL image objects for the most recently used ones around.
+static const int INPUT_CACHE_SIZE = 4;
+// Output textures are allocated in size classes. The ones dropped due to a
+// resize are kept around for a while in case the size changes back.
+static const int OUTPUT_POOL_SIZE = 2;
+static const int OUTPUT_SIZE_ALIGNMENT = 64;
+
+static inline QSize outputSizeClass(const QSize &size)
 {
-    Q_D(const QQuickCLImageRunnable);
-    return d->queue;
+    const int a = OUTPUT_SIZE_ALIGNMENT;
+    return QSize((size.width() + a - 1) / a * a, (size.height() + a - 1) / a * a);
 }
 
-/*!
-    Sets the name of the property that is queried from the item that was passed
-    to the constructor. The default value is \c source.
- */
-void QQuickCLImageRunnable::setSourcePropertyName(const QByteArray &name)
+// The entries are keyed on the QSGTexture as well since OpenGL reuses the
+// names of deleted textures. An entry whose QSGTexture is gone may wrap a
+// deleted texture and must not be used anymore.
+cl_mem QQuickCLImageRunnablePrivate::inputImage(QSGTexture *texture, cl_int *err)
 {
-    Q_D(QQuickCLImageRunnable);
-    d->sourcePropertyName = name;
+    const uint id = texture->textureId();
+    const QSize size = texture->textureSize();
+    for (int i = inputCache.count() - 1; i >= 0; --i) {
+        const InputImage &input(inputCache.at(i));
+        if (!input.source) {
+            clReleaseMemObject(input.mem);
+            inputCache.removeAt(i);
+        } else if (input.source == texture && input.texture == id && input.size == size) {
+            if (i)
+                inputCache.move(i, 0);
+            return inputCache.first().mem;
+        }
+    }
+
+    InputImage input;
+    input.source = texture;
+    input.texture = id;
+    input.size = size;
+    input.mem = clCreateFromGLTexture2D(item->context()->context(), CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0,
+                                        id, err);
+    if (!input.mem)
+        return 0;
+    inputCache.prepend(input);
+    while (inputCache.count() > INPUT_CACHE_SIZE)
+        clReleaseMemObject(inputCache.takeLast().mem);
+    return input.mem;
 }
 
-QSGNode *QQuickCLImageRunnable::update(QSGNode *node)
+struct OutputFormatInfo {
+    QOpenGLTexture::TextureFormat format;
+    QOpenGLTexture::PixelFormat pixelFormat;
+    QOpenGLTexture::PixelType pixelType;
+    int bytesPerPixel;
+};
+
+static const OutputFormatInfo outputFormats[] = {
+    { QOpenGLTexture::R8_UNorm, QOpenGLTexture::Red, QOpenGLTexture::UInt8, 1 },
+    { QOpenGLTexture::RG8_UNorm, QOpenGLTexture::RG, QOpenGLTexture::UInt8, 2 },
+    { QOpenGLTexture::RGBA8_UNorm, QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, 4 },
+    { QOpenGLTexture::R16F, QOpenGLTexture::Red, QOpenGLTexture::Float16, 2 },
+    { QOpenGLTexture::RGBA16F, QOpenGLTexture::RGBA, QOpenGLTexture::Float16, 8 },
+    { QOpenGLTexture::R32F, QOpenGLTexture::Red, QOpenGLTexture::Float32, 4 }
+};
+
+static const OutputFormatInfo *outputFormatInfo(QOpenGLTexture::TextureFormat format)
 {
-    Q_D(QQuickCLImageRunnable);
-    QSGTextureProvider *textureProvider;
-    QSGTexture *texture;
-    QQuickItem *source = d->item->property(d->sourcePropertyName.constData()).value<QQuickItem *>();
-    if (!source
-            || !source->isTextureProvider()
-            || !(textureProvider = source->textureProvider())
-            || !(texture = textureProvider->texture())) {
-        delete node;
-        return 0;
+    for (size_t i = 0; i < sizeof(outputFormats) / sizeof(outputFormats[0]); ++i) {
+        if (outputFormats[i].format == format)
+            return &outputFormats[i];
     }
+    return 0;
+}
 
-    QSGDynamicTexture *dtex = qobject_cast<QSGDynamicTexture *>(texture);
-    if (dtex)
-        dtex->updateTexture();
+void QQuickCLImageRunnablePrivate::releaseOutputTexture(const OutputTexture &t)
+{
+    if (t.mem)
+        clReleaseMemObject(t.mem);
+    if (t.texture && QOpenGLContext::currentContext())
+        QOpenGLContext::currentContext()->functions()->glDeleteTextures(1, &t.texture);
+}
 
-    if (!texture->textureId()) { // the texture provider may not be ready yet, try again later
-        d->item->scheduleUpdate();
-        return node;
-    }
+// Returns true when the output texture has changed. Without interop the
+// texture is filled via glTexSubImage2D() and there is nothing to pad it
+// with, so it gets the exact size.
+bool QQuickCLImageRunnablePrivate::ensureOutputTexture(const QSize &size)
+{
+    const QSize allocSize = interop ? outputSizeClass(size) : size;
+    if (output.texture && output.size == allocSize)
+        return false;
 
-    if (d->inputTexture != uint(texture->textureId())
-            || d->textureSize != texture->textureSize()
-            || (!d->flags.testFlag(NoOutputImage) && !d->outputTexture)) {
-        if (d->image[0])
-            clReleaseMemObject(d->image[0]);
-        d->image[0] = 0;
-        if (d->image[1])
-            clReleaseMemObject(d->image[1]);
-        d->image[1] = 0;
-        delete d->outputTexture;
-        d->outputTexture = 0;
-        delete node;
-        node = 0;
+    if (output.texture) {
+        outputPool.prepend(output);
+        while (outputPool.count() > OUTPUT_POOL_SIZE)
+            releaseOutputTexture(outputPool.takeLast());
+        output.texture = 0;
+        output.mem = 0;
     }
 
-    QQuickCLContext *clctx = d->item->context();
-    Q_ASSERT(clctx);
-    cl_int err = 0;
-    if (!d->image[0])
-        d->image[0] = clCreateFromGLTexture2D(clctx->context(), CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0,
-                                              texture->textureId(), &err);
-    if (!d->image[0]) {
-        if (err == CL_INVALID_GL_OBJECT) // the texture provider may not be ready yet, try again later
-            d->item->scheduleUpdate();
-        else
-            qWarning("Failed to create OpenCL image object from input OpenGL texture: %d", err);
-        return node;
+    for (int i = 0; i < outputPool.count(); ++i) {
+        if (outputPool[i].size == allocSize) {
+            output = outputPool.takeAt(i);
+            return true;
+        }
     }
 
-    d->inputTexture = texture->textureId();
-    d->textureSize = texture->textureSize();
+    return allocateOutputTexture(&output, allocSize);
+}
 
-    const int imageCount = d->flags.testFlag(NoOutputImage) ? 1 : 2;
-    if (imageCount == 2) {
-        if (!d->outputTexture)
-            d->outputTexture = new QOpenGLTexture(QImage(d->textureSize, QImage::Format_RGB32));
+bool QQuickCLImageRunnablePrivate::allocateOutputTexture(OutputTexture *t, const QSize &allocSize)
+{
+    // Allocate the storage without uploading any data, there is no need for
+    // zero-initialized contents since the kernels overwrite them anyway.
+    QOpenGLContext *ctx = QOpenGLContext::currentContext();
+    QOpenGLFunctions *f = ctx->functions();
+    const OutputFormatInfo *info = outputFormatInfo(outputFormat);
+    // OpenGL ES 2.0 has no sized internal formats.
+    const GLint internalFormat = ctx->isOpenGLES() && ctx->format().majorVersion() < 3
+            ? GLint(info->pixelFormat) : GLint(info->format);
+    f->glGenTextures(1, &t->texture);
+    f->glBindTexture(GL_TEXTURE_2D, t->texture);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    f->glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, allocSize.width(), allocSize.height(), 0,
+                    GLenum(info->pixelFormat), GLenum(info->pixelType), 0);
+    f->glBindTexture(GL_TEXTURE_2D, 0);
+    t->size = allocSize;
+    t->mem = 0;
 
-        if (!d->image[1])
-            d->image[1] = clCreateFromGLTexture2D(clctx->context(), CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0,
-                                                  d->outputTexture->textureId(), &err);
-        if (!d->image[1]) {
+    if (interop) {
+        cl_int err;
+        t->mem = clCreateFromGLTexture2D(item->context()->context(), CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0,
+                                         t->texture, &err);
+        if (!t->mem)
             qWarning("Failed to create OpenCL image object for output OpenGL texture: %d", err);
-            return node;
+    }
+    return true;
+}
+
+// Linear filtering reads one texel beyond the area shown. Output textures
+// that are larger due to the size classes get the last column and row of
+// the results repeated there, like GL_CLAMP_TO_EDGE does at the real edges.
+// Otherwise the uninitialized contents would bleed in when magnifying.
+void QQuickCLImageRunnablePrivate::padOutput(cl_mem mem, const QSize &size, const QSize &allocSize)
+{
+    const int w = size.width();
+    const int h = size.height();
+    if (w < allocSize.width()) {
+        const size_t src[3] = { size_t(w - 1), 0, 0 };
+        const size_t dst[3] = { size_t(w), 0, 0 };
+        const size_t region[3] = { 1, size_t(h), 1 };
+        clEnqueueCopyImage(queue, mem, mem, src, dst, region, 0, 0, traceEvent("pad"));
+    }
+    if (h < allocSize.height()) {
+        const size_t src[3] = { 0, size_t(h - 1), 0 };
+        const size_t dst[3] = { 0, size_t(h), 0 };
+        const size_t region[3] = { size_t(qMin(w + 1, allocSize.width())), 1, 1 };
+        clEnqueueCopyImage(queue, mem, mem, src, dst, region, 0, 0, traceEvent("pad"));
+    }
+}
+
+// Returns true when the ring has been (re)allocated.
+bool QQuickCLImageRunnablePrivate::ensureRing(const QSize &size)
+{
+    const QSize allocSize = outputSizeClass(size);
+    if (ring.count() == framesInFlight && ring.first().output.size == allocSize)
+        return false;
+
+    releaseRing();
+    // The textures are owned by the ring, not the node, since the node
+    // switches between them.
+    ring.resize(framesInFlight);
+    for (int i = 0; i < ring.count(); ++i) {
+        RingSlot &slot(ring[i]);
+        allocateOutputTexture(&slot.output, allocSize);
+        slot.texture = item->window()->createTextureFromId(slot.output.texture, allocSize);
+        slot.done = 0;
+        slot.profEv[0] = slot.profEv[1] = 0;
+        slot.size = size;
+        slot.submitted = 0;
+        slot.serial = 0;
+    }
+    return true;
+}
+
+void QQuickCLImageRunnablePrivate::releaseRing()
+{
+    if (ring.isEmpty())
+        return;
+    // The textures must not be deleted while OpenCL may still write to them.
+    harvestRing(true);
+    foreach (const RingSlot &slot, ring) {
+        delete slot.texture;
+        releaseOutputTexture(slot.output);
+    }
+    ring.clear();
+    ringShown = -1;
+}
+
+// Checks the frames in flight and picks the most recent finished one for
+// showing. When wait is true, blocks until all frames have finished.
+void QQuickCLImageRunnablePrivate::harvestRing(bool wait)
+{
+    for (int i = 0; i < ring.count(); ++i) {
+        RingSlot &slot(ring[i]);
+        if (!slot.done)
+            continue;
+        if (wait) {
+            waitForEvent(slot.done);
+        } else {
+            cl_int status = CL_QUEUED;
+            clGetEventInfo(slot.done, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, 0);
+            // Negative values indicate an error, the frame will never finish.
+            if (status > CL_COMPLETE)
+                continue;
+        }
+        clReleaseEvent(slot.done);
+        slot.done = 0;
+        if (slot.profEv[0] && slot.profEv[1])
+            recordElapsed(slot.profEv[0], slot.profEv[1]);
+        for (int j = 0; j < 2; ++j) {
+            if (slot.profEv[j])
+                clReleaseEvent(slot.profEv[j]);
+            slot.profEv[j] = 0;
         }
+        if (ringShown < 0 || slot.serial > ring[ringShown].serial) {
+            ringShown = i;
+            latency = double(timer.nsecsElapsed() - slot.submitted) / 1000000.0;
+        }
+    }
+}
+
+// Returns the least recently used slot that is neither shown nor in flight,
+// waiting for the oldest frame in flight when there is none.
+int QQuickCLImageRunnablePrivate::freeRingSlot()
+{
+    int oldest = -1;
+    for (int i = 0; i < ring.count(); ++i) {
+        if (i != ringShown && (oldest < 0 || ring[i].serial < ring[oldest].serial))
+            oldest = i;
+    }
+    if (ring[oldest].done) {
+        waitForEvent(ring[oldest].done);
+        harvestRing(false);
+        // The waited for frame may have become the one to show.
+        if (ringShown == oldest)
+            return freeRingSlot();
     }
+    return oldest;
+}
+
+// Returns the event argument for an enqueue function, or null when not
+// tracing. The events are handed over to the tracer in commitTraces().
+cl_event *QQuickCLImageRunnablePrivate::traceEvent(const QByteArray &name)
+{
+    if (!tracing)
+        return 0;
+    PendingTrace *t = new PendingTrace;
+    t->name = name;
+    t->begin = 0;
+    t->end = 0;
+    t->enqueued = QQuickCLTracer::instance()->timestamp();
+    pendingTraces.append(t);
+    return &t->end;
+}
+
+void QQuickCLImageRunnablePrivate::traceExistingEvent(const QByteArray &name, cl_event event, qint64 enqueued)
+{
+    if (!tracing || !event)
+        return;
+    clRetainEvent(event);
+    PendingTrace *t = new PendingTrace;
+    t->name = name;
+    t->begin = 0;
+    t->end = event;
+    t->enqueued = enqueued;
+    pendingTraces.append(t);
+}
+
+// Ranges are delimited by markers, covering whatever was enqueued in between.
+QQuickCLImageRunnablePrivate::PendingTrace *QQuickCLImageRunnablePrivate::beginTraceRange(const QByteArray &name)
+{
+    cl_event *ev = traceEvent(name);
+    if (!ev)
+        return 0;
+    PendingTrace *t = pendingTraces.last();
+    if (clEnqueueMarker(queue, &t->begin) != CL_SUCCESS)
+        t->begin = 0;
+    return t;
+}
+
+void QQuickCLImageRunnablePrivate::endTraceRange(PendingTrace *range)
+{
+    if (range && range->begin && clEnqueueMarker(queue, &range->end) != CL_SUCCESS)
+        range->end = 0;
+}
 
-    if (d->needsExplicitSync)
-        QOpenGLContext::currentContext()->functions()->glFinish();
+void QQuickCLImageRunnablePrivate::commitTraces()
+{
+    QQuickCLTracer *tracer = QQuickCLTracer::instance();
+    foreach (PendingTrace *t, pendingTraces) {
+        if (t->end)
+            tracer->traceRange(traceTrack, t->name, t->begin, t->end, t->enqueued);
+        else if (t->begin)
+            clReleaseEvent(t->begin);
+        delete t;
+    }
+    pendingTraces.clear();
+}
 
-    err = clEnqueueAcquireGLObjects(d->queue, imageCount, d->image, 0, 0, 0);
+// Reads the profiling info of a finished frame and adds it to the rolling
+// window. Does not release the events. Like the ranges of QQuickCLTracer, the
+// frame starts when the start marker completes, the time it spent queued
+// behind earlier work does not belong to this frame.
+void QQuickCLImageRunnablePrivate::recordElapsed(cl_event startEv, cl_event endEv)
+{
+    cl_ulong start = 0, end = 0;
+    cl_int err = clGetEventProfilingInfo(startEv, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &start, 0);
     if (err != CL_SUCCESS) {
-        qWarning("Failed to queue acquiring the GL textures: %d", err);
-        return node;
+        qWarning("Failed to get profiling info for start event: %d", err);
+        return;
     }
+    err = clGetEventProfilingInfo(endEv, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, 0);
+    if (err != CL_SUCCESS) {
+        qWarning("Failed to get profiling info for end event: %d", err);
+        return;
+    }
+    elapsed = double(end - start) / 1000000.0;
+    if (stats)
+        stats->addKernelTime(elapsed);
+    // Not while being destroyed, the item may be gone. Without interop the
+    // working size never changes, see workingSize().
+    if (stats && interop && flags.testFlag(QQuickCLImageRunnable::AdaptiveResolution))
+        adjustScale(elapsed);
+    if (profileWindow.count() < profileWindowSize) {
+        profileWindow.append(elapsed);
+    } else {
+        profileWindow[profileNext] = elapsed;
+        profileNext = (profileNext + 1) % profileWindowSize;
+    }
+}
 
-    if (d->flags.testFlag(Profile))
-        if (clEnqueueMarker(d->queue, &d->profEv[0]) != CL_SUCCESS)
-            qWarning("Failed to enqueue profiling marker (start)");
+// Limits the number of frames whose profiling info is outstanding when the
+// device falls far behind.
+static const int MAX_PENDING_PROFILING = 16;
+
+// Collects the profiling info of the frames that have finished, in order.
+// When wait is true, waits for all of them.
+void QQuickCLImageRunnablePrivate::harvestProfiling(bool wait)
+{
+    while (!pendingProfiling.isEmpty()) {
+        const QPair<cl_event, cl_event> ev = pendingProfiling.first();
+        if (wait || pendingProfiling.count() > MAX_PENDING_PROFILING) {
+            waitForEvent(ev.second);
+        } else {
+            cl_int status = CL_QUEUED;
+            clGetEventInfo(ev.second, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, 0);
+            if (status > CL_COMPLETE)
+                break;
+        }
+        recordElapsed(ev.first, ev.second);
+        clReleaseEvent(ev.first);
+        clReleaseEvent(ev.second);
+        pendingProfiling.removeFirst();
+    }
+}
 
-    runKernel(d->image[0], d->image[1], d->textureSize);
+void QQuickCLImageRunnablePrivate::waitForEvent(cl_event event)
+{
+    const qint64 start = timer.nsecsElapsed();
+    clWaitForEvents(1, &event);
+    blockedTime += double(timer.nsecsElapsed() - start) / 1000000.0;
+}
 
-    if (d->flags.testFlag(Profile))
-        if (clEnqueueMarker(d->queue, &d->profEv[1]) != CL_SUCCESS)
-            qWarning("Failed to enqueue profiling marker (end)");
+static qint64 memObjectSize(cl_mem mem)
+{
+    size_t size = 0;
+    if (mem)
+        clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size), &size, 0);
+    return qint64(size);
+}
 
-    clEnqueueReleaseGLObjects(d->queue, imageCount, d->image, 0, 0, 0);
+// The size of the images and output textures owned by the runnable. The
+// input images wrap the source textures and are not included.
+qint64 QQuickCLImageRunnablePrivate::memoryUsage() const
+{
+    qint64 bytes = 0;
+    if (!interop) {
+        for (int i = 0; i < 2; ++i)
+            bytes += memObjectSize(image[i]);
+    }
+    foreach (cl_mem mem, intermediates)
+        bytes += memObjectSize(mem);
+    bytes += memObjectSize(scaledInput);
+    foreach (const StateImage &st, stateImages) {
+        for (int i = 0; i < 2; ++i)
+            bytes += memObjectSize(st.image[i]);
+    }
+    // CL_MEM_SIZE is not reliable for objects created from GL textures.
+    QVector<QSize> textures;
+    if (output.texture)
+        textures.append(output.size);
+    foreach (const OutputTexture &t, outputPool)
+        textures.append(t.size);
+    foreach (const RingSlot &slot, ring)
+        textures.append(slot.output.size);
+    const int bytesPerPixel = outputFormatInfo(outputFormat)->bytesPerPixel;
+    foreach (const QSize &size, textures)
+        bytes += qint64(size.width()) * size.height() * bytesPerPixel;
+    return bytes;
+}
 
-    if (d->flags.testFlag(ForceCLFinish) || d->needsExplicitSync || d->flags.testFlag(Profile))
-        clFinish(d->queue);
+void QQuickCLImageRunnablePrivate::reportFrameStats(double acquireTime, double releaseTime)
+{
+    if (sync)
+        blockedTime += sync->takeBlockedTime();
+    stats->addFrame();
+    stats->addAcquireTime(acquireTime);
+    stats->addReleaseTime(releaseTime);
+    stats->addBlockedTime(blockedTime);
+    stats->setMemoryBytes(memoryUsage());
+    blockedTime = 0;
+}
+
+// Collects the rects added via addDirtyRect() and, for the tracked items,
+// the areas covered before and after they changed, in texture pixels.
+// Called on the render thread while the gui thread is blocked.
+QRect QQuickCLImageRunnablePrivate::takeDirtyRect(const QSize &size)
+{
+    QMutexLocker lock(&dirtyMutex);
+    QRect r = dirty;
+    dirty = QRect();
+    lock.unlock();
+
+    QQuickItem *source = sourceTracker->source();
+    if (trackedItems.isEmpty() || !source || source->width() <= 0 || source->height() <= 0)
+        return r;
 
-    if (d->flags.testFlag(Profile)) {
-        cl_ulong start = 0, end = 0;
-        err = clGetEventProfilingInfo(d->profEv[0], CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &start, 0);
-        if (err != CL_SUCCESS)
-            qWarning("Failed to get profiling info for start event: %d", err);
-        err = clGetEventProfilingInfo(d->profEv[1], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, 0);
-        if (err != CL_SUCCESS)
-            qWarning("Failed to get profiling info for end event: %d", err);
-        d->elapsed = double(end - start) / 1000000.0;
-        clReleaseEvent(d->profEv[0]);
-        clReleaseEvent(d->profEv[1]);
+    const qreal sx = size.width() / source->width();
+    const qreal sy = size.height() / source->height();
+    for (int i = trackedItems.count() - 1; i >= 0; --i) {
+        TrackedItem &t(trackedItems[i]);
+        QRect rect;
+        if (t.item && t.item->isVisible()) {
+            const QRectF mapped = t.item->mapRectToItem(source, t.item->boundingRect());
+            rect = QRectF(mapped.x() * sx, mapped.y() * sy, mapped.width() * sx, mapped.height() * sy).toAlignedRect();
+        }
+        if (rect != t.rect) {
+            r |= t.rect;
+            r |= rect;
+            t.rect = rect;
+        }
+        if (!t.item)
+            trackedItems.remove(i);
     }
+    return r;
+}
 
-    if (imageCount == 1)
-        return 0;
+// The size the kernels run at. Scaling requires CL-GL interop.
+QSize QQuickCLImageRunnablePrivate::workingSize(const QSize &sourceSize) const
+{
+    if (!interop)
+        return sourceSize;
+    QSize size = sourceSize;
+    if (flags.testFlag(QQuickCLImageRunnable::ScaleToItemSize) && item->window()) {
+        const qreal dpr = item->window()->effectiveDevicePixelRatio();
+        size = size.boundedTo(QSize(qCeil(item->width() * dpr), qCeil(item->height() * dpr)));
+    }
+    if (flags.testFlag(QQuickCLImageRunnable::AdaptiveResolution) && scale < 1)
+        size = QSize(qRound(size.width() * scale), qRound(size.height() * scale));
+    return size.expandedTo(QSize(1, 1));
+}
+
+// Number of profiled frames to ignore after changing the scale, so that
+// frames enqueued with the previous scale do not cause another change.
+static const int GOVERNOR_COOLDOWN = 10;
+// The scale moves in steps of 1/SCALE_STEPS to limit reallocations.
+static const int SCALE_STEPS = 16;
+
+// Lowers the working resolution when the kernels exceed the frame time
+// budget and raises it again when they take less than half of it. The
+// kernel time is assumed to be proportional to the number of pixels. The
+// gap between the two thresholds and the cooldown prevent oscillation.
+void QQuickCLImageRunnablePrivate::adjustScale(double ms)
+{
+    kernelAverage = kernelAverage > 0 ? 0.8 * kernelAverage + 0.2 * ms : ms;
+    if (governorCooldown > 0) {
+        --governorCooldown;
+        return;
+    }
+
+    double newScale = scale;
+    if (kernelAverage > frameBudget)
+        newScale = qFloor(scale * qSqrt(0.9 * frameBudget / kernelAverage) * SCALE_STEPS) / double(SCALE_STEPS);
+    else if (kernelAverage < 0.5 * frameBudget && scale < 1)
+        newScale = qFloor(scale * 1.25 * SCALE_STEPS) / double(SCALE_STEPS);
+    newScale = qBound(minScale, newScale, 1.0);
 
+    if (newScale != scale) {
+        qCDebug(logCL, "Kernel time %f ms, budget %f ms, changing resolution scale from %f to %f",
+                kernelAverage, frameBudget, scale, newScale);
+        scale = newScale;
+        kernelAverage = 0;
+        governorCooldown = GOVERNOR_COOLDOWN;
+        // Present the new resolution even when nothing else changes.
+        QQuickCLItemPrivate::get(item)->postUpdate();
+    }
+}
+
+bool QQuickCLImageRunnablePrivate::hasPingPongState() const
+{
+    foreach (const StateImage &st, stateImages) {
+        if (st.pingPong)
+            return true;
+    }
+    return false;
+}
+
+void QQuickCLImageRunnablePrivate::endFrameTrace(qint64 cpuStart)
+{
+    if (!tracing)
+        return;
+    commitTraces();
+    QQuickCLTracer *tracer = QQuickCLTracer::instance();
+    tracer->traceCpu(cpuTrack, QByteArrayLiteral("update"), cpuStart, tracer->timestamp());
+}
+
+QSGNode *QQuickCLImageRunnablePrivate::updateNode(QSGNode *node)
+{
     QSGSimpleTextureNode *tnode = static_cast<QSGSimpleTextureNode *>(node);
     if (!tnode) {
         tnode = new QSGSimpleTextureNode;
         tnode->setFiltering(QSGTexture::Linear);
-        tnode->setTexture(d->item->window()->createTextureFromId(d->outputTexture->textureId(), d->textureSize));
+        if (ring.isEmpty()) {
+            tnode->setOwnsTexture(true);
+            tnode->setTexture(item->window()->createTextureFromId(output.texture, output.size));
+        }
+    }
+    QSize size = textureSize;
+    if (!ring.isEmpty()) {
+        tnode->setTexture(ring[ringShown].texture);
+        size = ring[ringShown].size;
     }
-    tnode->setRect(d->item->boundingRect());
+    tnode->setRect(item->boundingRect());
+    // The output texture may be larger than the source due to the size classes.
+    tnode->setSourceRect(QRectF(QPointF(0, 0), size));
     tnode->markDirty(QSGNode::DirtyMaterial);
-
     return tnode;
 }
 
-/*!
-    Returns the number of milliseconds spent on OpenCL operations during the
-    last finished invocation of runKernel().
+cl_mem QQuickCLImageRunnablePrivate::createIntermediateImage()
+{
+    cl_int err;
+    cl_mem mem = clCreateImage2D(item->context()->context(), CL_MEM_READ_WRITE, &intermediateFormat,
+                                 textureSize.width(), textureSize.height(), 0, 0, &err);
+    if (!mem) {
+        qWarning("Failed to create intermediate OpenCL image: %d", err);
+        return 0;
+    }
+    intermediates.append(mem);
+    return mem;
+}
 
-    \note OpenCL command queue profiling must be enabled by passing the \c Profile
-    flag to the constructor.
- */
-double QQuickCLImageRunnable::elapsed() const
+bool QQuickCLImageRunnablePrivate::clearImage(cl_mem mem, const QSize &size)
 {
-    Q_D(const QQuickCLImageRunnable);
-    return d->elapsed;
+    size_t elementSize = 0;
+    cl_int err = clGetImageInfo(mem, CL_IMAGE_ELEMENT_SIZE, sizeof(elementSize), &elementSize, 0);
+    if (err != CL_SUCCESS) {
+        qWarning("Failed to query image element size: %d", err);
+        return false;
+    }
+    // There is no clEnqueueFillImage() in OpenCL 1.1. This only happens on
+    // resize so a blocking write of zeroes is acceptable.
+    const QByteArray zeroes(int(size.width() * size.height() * elementSize), '\0');
+    const size_t origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { size_t(size.width()), size_t(size.height()), 1 };
+    err = clEnqueueWriteImage(queue, mem, CL_TRUE, origin, region, 0, 0, zeroes.constData(), 0, 0, traceEvent("clear"));
+    if (err != CL_SUCCESS) {
+        qWarning("Failed to clear image: %d", err);
+        return false;
+    }
+    return true;
+}
+
+static const char *resampleSrc =
+        "constant sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;\n"
+        "kernel void resample(read_only image2d_t src, write_only image2d_t dst)\n"
+        "{\n"
+        "    int2 pos = (int2)(get_global_id(0), get_global_id(1));\n"
+        "    float2 coord = ((float2)(pos.x, pos.y) + 0.5f) / (float2)(get_image_width(dst), get_image_height(dst));\n"
+        "    write_imagef(dst, pos, read_imagef(src, sampler, coord));\n"
+        "}\n";
+
+bool QQuickCLImageRunnablePrivate::resample(cl_mem src, cl_mem dst, const QSize &dstSize)
+{
+    if (!resampleKernel) {
+        QQuickCLContext *clctx = item->context();
+        cl_program program = clctx->buildProgram(resampleSrc);
+        if (!program)
+            return false;
+        resampleKernel = clctx->createKernel(program, "resample");
+        clReleaseProgram(program);
+        if (!resampleKernel)
+            return false;
+    }
+    clSetKernelArg(resampleKernel, 0, sizeof(cl_mem), &src);
+    clSetKernelArg(resampleKernel, 1, sizeof(cl_mem), &dst);
+    const size_t workSize[2] = { size_t(dstSize.width()), size_t(dstSize.height()) };
+    cl_int err = clEnqueueNDRangeKernel(queue, resampleKernel, 2, 0, workSize, 0, 0, 0, traceEvent("resample"));
+    if (err != CL_SUCCESS) {
+        qWarning("Failed to enqueue resample kernel: %d", err);
+        return false;
+    }
+    return true;
+}
+
+bool QQuickCLImageRunnablePrivate::updateStateImages()
+{
+    for (int idx = 0; idx < stateImages.count(); ++idx) {
+        StateImage &st(stateImages[idx]);
+        if (st.size == textureSize && st.image[0])
+            continue;
+        const int count = st.pingPong ? 2 : 1;
+        for (int i = 0; i < count; ++i) {
+            cl_int err;
+            cl_mem mem = clCreateImage2D(item->context()->context(), CL_MEM_READ_WRITE, &st.format,
+                                         textureSize.width(), textureSize.height(), 0, 0, &err);
+            if (!mem) {
+                qWarning("Failed to create state image: %d", err);
+                return false;
+            }
+            cl_mem old = st.image[i];
+            bool ok;
+            if (old && st.policy == QQuickCLImageRunnable::RescaleContents) {
+                ok = resample(old, mem, textureSize);
+            } else {
+                ok = clearImage(mem, textureSize);
+                if (ok && old && st.policy == QQuickCLImageRunnable::KeepContents) {
+                    const size_t origin[3] = { 0, 0, 0 };
+                    const size_t region[3] = { size_t(qMin(st.size.width(), textureSize.width())),
+                                               size_t(qMin(st.size.height(), textureSize.height())), 1 };
+                    ok = clEnqueueCopyImage(queue, old, mem, origin, origin, region, 0, 0, 0) == CL_SUCCESS;
+                }
+            }
+            // Releasing is safe even if the commands using the old image are
+            // still pending, the implementation keeps it alive until then.
+            if (old)
+                clReleaseMemObject(old);
+            st.image[i] = mem;
+            if (!ok)
+                qWarning("Failed to initialize the contents of state image %d", idx);
+        }
+        st.size = textureSize;
+    }
+    return true;
+}
+
+static void copyRows(uchar *dst, size_t dstPitch, const uchar *src, size_t srcPitch, size_t rowSize, int rows)
+{
+    if (dstPitch == srcPitch && srcPitch == rowSize) {
+        memcpy(dst, src, rowSize * rows);
+        return;
+    }
+    for (int y = 0; y < rows; ++y)
+        memcpy(dst + y * dstPitch, src + y * srcPitch, rowSize);
+}
+
+static QOpenGLBuffer *createPixelBuffer(QOpenGLBuffer::Type type, QOpenGLBuffer::UsagePattern usage, int size)
+{
+    QOpenGLBuffer *buf = new QOpenGLBuffer(type);
+    if (!buf->create()) {
+        delete buf;
+        return 0;
+    }
+    buf->setUsagePattern(usage);
+    buf->bind();
+    buf->allocate(size);
+    buf->release();
+    return buf;
+}
+
+bool QQuickCLImageRunnablePrivate::prepareCopy(QQuickCLContext *clctx)
+{
+    const cl_image_format inputFormat = { CL_RGBA, CL_UNORM_INT8 };
+    const cl_image_format outputImageFormat = QQuickCLContext::toCLImageFormat(outputFormat);
+    const int imageCount = flags.testFlag(QQuickCLImageRunnable::NoOutputImage) ? 1 : 2;
+    const int byteSize = textureSize.width() * textureSize.height() * 4;
+    const int outputByteSize = textureSize.width() * textureSize.height() * outputFormatInfo(outputFormat)->bytesPerPixel;
+    cl_int err = CL_SUCCESS;
+    for (int i = 0; i < imageCount; ++i) {
+        if (image[i])
+            continue;
+        const cl_mem_flags memFlags = (i == 0 ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY) | CL_MEM_ALLOC_HOST_PTR;
+        image[i] = clCreateImage2D(clctx->context(), memFlags, i == 0 ? &inputFormat : &outputImageFormat,
+                                   textureSize.width(), textureSize.height(), 0, 0, &err);
+        if (!image[i]) {
+            qWarning("Failed to create OpenCL image object: %d", err);
+            return false;
+        }
+    }
+
+    if (usePixelBuffers && !packBuffer) {
+        packBuffer = createPixelBuffer(QOpenGLBuffer::PixelPackBuffer, QOpenGLBuffer::StreamRead, byteSize);
+        for (int i = 0; i < 2; ++i) {
+            if (imageCount == 2)
+                unpackBuffer[i] = createPixelBuffer(QOpenGLBuffer::PixelUnpackBuffer, QOpenGLBuffer::StreamDraw, outputByteSize);
+            if (!packBuffer || (imageCount == 2 && !unpackBuffer[i])) {
+                qWarning("Failed to create pixel buffer objects, falling back to plain glReadPixels");
+                usePixelBuffers = false;
+                releaseImages();
+                return prepareCopy(clctx);
+            }
+        }
+    }
+
+    return true;
+}
+
+bool QQuickCLImageRunnablePrivate::copyFromTexture(uint texture)
+{
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+    const int w = textureSize.width();
+    const int h = textureSize.height();
+
+    GLint prevFbo = 0;
+    f->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFbo);
+    if (!readFbo)
+        f->glGenFramebuffers(1, &readFbo);
+    f->glBindFramebuffer(GL_FRAMEBUFFER, readFbo);
+    f->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    const bool complete = f->glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if (complete) {
+        if (usePixelBuffers) {
+            packBuffer->bind();
+            f->glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        } else {
+            pixels.resize(w * h * 4);
+            f->glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        }
+    }
+    f->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    f->glBindFramebuffer(GL_FRAMEBUFFER, prevFbo);
+    if (!complete) {
+        qWarning("Failed to attach the source texture to a framebuffer for reading");
+        return false;
+    }
+
+    const uchar *src;
+    if (usePixelBuffers) {
+        // Waits for the readback, the kernels of this frame need the data.
+        src = static_cast<const uchar *>(packBuffer->map(QOpenGLBuffer::ReadOnly));
+        if (!src) {
+            QOpenGLBuffer::release(QOpenGLBuffer::PixelPackBuffer);
+            qWarning("Failed to map pixel buffer, falling back to plain glReadPixels");
+            usePixelBuffers = false;
+            return copyFromTexture(texture);
+        }
+    } else {
+        src = reinterpret_cast<const uchar *>(pixels.constData());
+    }
+
+    const size_t origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { size_t(w), size_t(h), 1 };
+    size_t rowPitch = 0;
+    cl_int err;
+    uchar *dst = static_cast<uchar *>(clEnqueueMapImage(queue, image[0], CL_TRUE, CL_MAP_WRITE, origin, region,
+                                                        &rowPitch, 0, 0, 0, traceEvent("map input"), &err));
+    if (dst) {
+        copyRows(dst, rowPitch, src, w * 4, w * 4, h);
+        clEnqueueUnmapMemObject(queue, image[0], dst, 0, 0, traceEvent("unmap input"));
+    } else {
+        qWarning("Failed to map input image: %d", err);
+    }
+
+    if (usePixelBuffers) {
+        packBuffer->unmap();
+        QOpenGLBuffer::release(QOpenGLBuffer::PixelPackBuffer);
+    }
+    return dst != 0;
+}
+
+bool QQuickCLImageRunnablePrivate::copyToTexture()
+{
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+    const OutputFormatInfo *info = outputFormatInfo(outputFormat);
+    const GLenum pixelFormat = GLenum(info->pixelFormat);
+    const GLenum pixelType = GLenum(info->pixelType);
+    const int w = textureSize.width();
+    const int h = textureSize.height();
+    const int rowSize = w * info->bytesPerPixel;
+    const int slot = copyFrame % 2;
+
+    const size_t origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { size_t(w), size_t(h), 1 };
+    size_t rowPitch = 0;
+    cl_int err;
+    const uchar *src = static_cast<const uchar *>(clEnqueueMapImage(queue, image[1], CL_TRUE, CL_MAP_READ, origin, region,
+                                                                    &rowPitch, 0, 0, 0, traceEvent("map output"), &err));
+    if (!src) {
+        qWarning("Failed to map output image: %d", err);
+        return false;
+    }
+
+    f->glBindTexture(GL_TEXTURE_2D, output.texture);
+    // Rows are tightly packed, which is not necessarily a multiple of 4 bytes
+    // for the one and two channel formats.
+    GLint prevAlignment = 4;
+    f->glGetIntegerv(GL_UNPACK_ALIGNMENT, &prevAlignment);
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    uchar *dst = 0;
+    if (usePixelBuffers) {
+        // Uploading from a pixel buffer lets the copy to the texture happen
+        // asynchronously. Alternating between two buffers avoids waiting for
+        // the upload issued in the previous frame.
+        unpackBuffer[slot]->bind();
+        dst = static_cast<uchar *>(unpackBuffer[slot]->map(QOpenGLBuffer::WriteOnly));
+        if (dst) {
+            copyRows(dst, rowSize, src, rowPitch, rowSize, h);
+            unpackBuffer[slot]->unmap();
+            f->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, pixelFormat, pixelType, 0);
+        }
+        QOpenGLBuffer::release(QOpenGLBuffer::PixelUnpackBuffer);
+    }
+    if (!dst) {
+        if (rowPitch == size_t(rowSize)) {
+            f->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, pixelFormat, pixelType, src);
+        } else {
+            pixels.resize(rowSize * h);
+            copyRows(reinterpret_cast<uchar *>(pixels.data()), rowSize, src, rowPitch, rowSize, h);
+            f->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, pixelFormat, pixelType, pixels.constData());
+        }
+    }
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, prevAlignment);
+    f->glBindTexture(GL_TEXTURE_2D, 0);
+
+    clEnqueueUnmapMemObject(queue, image[1], const_cast<uchar *>(src), 0, 0, traceEvent("unmap output"));
+    return true;
+}
+
+/*!
+    Constructs a new QQuickCLImageRunnable instance associated with \a item.
+    Special behavior, for example computations producing arbitrary non-image
+    output, can be enabled via \a flags.
+ */
+QQuickCLImageRunnable::QQuickCLImageRunnable(QQuickCLItem *item, Flags flags)
+    : d_ptr(new QQuickCLImageRunnablePrivate(item, flags))
+{
+    Q_D(QQuickCLImageRunnable);
+    cl_int err;
+    d->profilingQueue = d->flags.testFlag(Profile) || d->flags.testFlag(AdaptiveResolution)
+            || QQuickCLTracer::instance()->isEnabled();
+    cl_command_queue_properties queueProps = d->profilingQueue ? CL_QUEUE_PROFILING_ENABLE : 0;
+    QQuickCLContext *clctx = item->context();
+    Q_ASSERT(clctx);
+    d->queue = clCreateCommandQueue(clctx->context(), clctx->device(), queueProps, &err);
+    if (!d->queue) {
+        qWarning("Failed to create OpenCL command queue: %d", err);
+        return;
+    }
+    d->interop = clctx->isGLInteropEnabled();
+    if (d->interop) {
+        d->sync = new QQuickCLGLSync(clctx, d->queue);
+    } else {
+        QOpenGLContext *ctx = QOpenGLContext::currentContext();
+        d->usePixelBuffers = ctx->isOpenGLES() ? ctx->format().majorVersion() >= 3
+                                               : ctx->format().version() >= qMakePair(2, 1);
+        qCDebug(logCL, "CL-GL interop not available, using copies (pixel buffers: %d)", d->usePixelBuffers);
+    }
+
+    if (d->flags.testFlag(PartialUpdates)) {
+        // Global work offsets require OpenCL 1.1.
+        size_t size = 0;
+        clGetDeviceInfo(clctx->device(), CL_DEVICE_VERSION, 0, 0, &size);
+        QByteArray version(int(size), '\0');
+        clGetDeviceInfo(clctx->device(), CL_DEVICE_VERSION, size, version.data(), 0);
+        if (version.startsWith("OpenCL 1.0")) {
+            qCDebug(logCL, "Partial updates are not supported by OpenCL 1.0 devices");
+            d->flags &= ~PartialUpdates;
+        } else {
+            d->sourceTracker->setUpdateOnTextureChange(true);
+        }
+    }
+}
+
+QQuickCLImageRunnable::~QQuickCLImageRunnable()
+{
+    delete d_ptr;
+}
+
+/*!
+    \return the OpenCL command queue.
+ */
+cl_command_queue QQuickCLImageRunnable::commandQueue() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->queue;
+}
+
+/*!
+    Sets the name of the property that is queried from the item that was passed
+    to the constructor. The default value is \c source.
+
+    The property is resolved once and is only read again after its notify
+    signal has been emitted. Properties without a notify signal are read on
+    every update.
+ */
+void QQuickCLImageRunnable::setSourcePropertyName(const QByteArray &name)
+{
+    Q_D(QQuickCLImageRunnable);
+    d->sourceTracker->setPropertyName(name);
+}
+
+/*!
+    Registers the asynchronous program \a build. Until the build has finished,
+    update() will keep returning the previous node, if there is one, without
+    calling runKernel().
+
+    This is typically called from the subclass' constructor after starting the
+    build via QQuickCLContext::buildProgramAsync(). Pass the associated
+    QQuickCLItem to buildProgramAsync() so that the item is updated
+    automatically once the build has finished.
+ */
+void QQuickCLImageRunnable::addProgramBuild(const QQuickCLProgramBuild &build)
+{
+    Q_D(QQuickCLImageRunnable);
+    if (!build.isNull())
+        d->pendingBuilds.append(build);
+}
+
+/*!
+    Sets the internal \a format of the output texture. The default is
+    \c RGBA8_UNorm. Single channel or floating point formats reduce the
+    bandwidth and memory needed when the results do not need four 8-bit
+    channels. The supported formats are \c R8_UNorm, \c RG8_UNorm,
+    \c RGBA8_UNorm, \c R16F, \c RGBA16F and \c R32F. The OpenCL image
+    passed as the output to runKernel() has the format returned by
+    QQuickCLContext::toCLImageFormat() for \a format.
+
+    The existing output textures are released and reallocated with the new
+    format on the next update(), which runs the kernels again. Like the other
+    functions of the runnable, this must be called on the render thread,
+    typically from the subclass' constructor.
+
+    \note Floating point and one or two channel formats require OpenGL 3.0 or
+    OpenGL ES 3.0. With CL-GL interop the OpenCL implementation must support
+    sharing textures of the given format.
+ */
+void QQuickCLImageRunnable::setOutputFormat(QOpenGLTexture::TextureFormat format)
+{
+    Q_D(QQuickCLImageRunnable);
+    if (!outputFormatInfo(format)) {
+        qWarning("QQuickCLImageRunnable: Unsupported output format 0x%x", format);
+        return;
+    }
+    if (d->outputFormat == format)
+        return;
+    d->outputFormat = format;
+    // The current node may still show the old textures.
+    d->outputFormatChanged = true;
+}
+
+/*!
+    \return the internal format of the output texture.
+ */
+QOpenGLTexture::TextureFormat QQuickCLImageRunnable::outputFormat() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->outputFormat;
+}
+
+/*!
+    Adds a stage reading the output of the previously added stage, or the
+    source image in case this is the first stage.
+
+    \return the index of the new stage.
+ */
+int QQuickCLImageRunnable::addStage()
+{
+    Q_D(QQuickCLImageRunnable);
+    return addStage(QVector<int>() << (d->stages.isEmpty() ? int(SourceImage) : d->stages.count() - 1));
+}
+
+/*!
+    Adds a stage reading the images given in \a inputs, which is a list of
+    indices of earlier stages or \c SourceImage. The images are passed to
+    runStage() in the same order. The last stage added writes the output
+    image.
+
+    \return the index of the new stage, or -1 if \a inputs refers to stages
+    that have not yet been added.
+ */
+int QQuickCLImageRunnable::addStage(const QVector<int> &inputs)
+{
+    Q_D(QQuickCLImageRunnable);
+    foreach (int input, inputs) {
+        if (input < SourceImage || input >= d->stages.count()) {
+            qWarning("QQuickCLImageRunnable: Invalid stage input %d", input);
+            return -1;
+        }
+    }
+    d->stages.append(inputs);
+    return d->stages.count() - 1;
+}
+
+/*!
+    \return the number of stages added via addStage().
+ */
+int QQuickCLImageRunnable::stageCount() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->stages.count();
+}
+
+/*!
+    Sets the \a format of the intermediate images passing data between stages.
+    This is useful when stages need more precision than the default
+    \c CL_RGBA, \c CL_UNORM_INT8.
+ */
+void QQuickCLImageRunnable::setIntermediateImageFormat(const cl_image_format &format)
+{
+    Q_D(QQuickCLImageRunnable);
+    if (format.image_channel_order == d->intermediateFormat.image_channel_order
+            && format.image_channel_data_type == d->intermediateFormat.image_channel_data_type)
+        return;
+    d->intermediateFormat = format;
+    foreach (cl_mem mem, d->intermediates)
+        clReleaseMemObject(mem);
+    d->intermediates.clear();
+}
+
+/*!
+    Registers a persistent state image with the format \c CL_RGBA,
+    \c CL_UNORM_INT8. \a policy specifies what happens to the contents when
+    the size of the source changes. When \a pingPong is \c true, the state is
+    backed by a pair of images that are swapped after each runKernel().
+
+    \return the index of the state image, to be passed to stateImage() and
+    nextStateImage().
+ */
+int QQuickCLImageRunnable::addStateImage(StateImagePolicy policy, bool pingPong)
+{
+    const cl_image_format format = { CL_RGBA, CL_UNORM_INT8 };
+    return addStateImage(policy, pingPong, format);
+}
+
+/*!
+    Registers a persistent state image with the given \a policy, \a pingPong
+    setting and image \a format.
+
+    \return the index of the state image.
+ */
+int QQuickCLImageRunnable::addStateImage(StateImagePolicy policy, bool pingPong, const cl_image_format &format)
+{
+    Q_D(QQuickCLImageRunnable);
+    QQuickCLImageRunnablePrivate::StateImage st;
+    st.policy = policy;
+    st.pingPong = pingPong;
+    st.format = format;
+    st.image[0] = st.image[1] = 0;
+    st.current = 0;
+    d->stateImages.append(st);
+    return d->stateImages.count() - 1;
+}
+
+/*!
+    \return the current contents of the state image \a index, or \c 0 when
+    the images have not yet been allocated. The images are always available
+    in runKernel() and runStage().
+ */
+cl_mem QQuickCLImageRunnable::stateImage(int index) const
+{
+    Q_D(const QQuickCLImageRunnable);
+    const QQuickCLImageRunnablePrivate::StateImage &st(d->stateImages.at(index));
+    return st.image[st.current];
+}
+
+/*!
+    \return the image the new state for \a index is to be written to. For
+    ping-pong state images this is the image that becomes stateImage() after
+    runKernel() returns. For single state images this is the same as
+    stateImage().
+ */
+cl_mem QQuickCLImageRunnable::nextStateImage(int index) const
+{
+    Q_D(const QQuickCLImageRunnable);
+    const QQuickCLImageRunnablePrivate::StateImage &st(d->stateImages.at(index));
+    return st.pingPong ? st.image[st.current ^ 1] : st.image[st.current];
+}
+
+void QQuickCLImageRunnable::runKernel(cl_mem inImage, cl_mem outImage, const QSize &size)
+{
+    Q_D(QQuickCLImageRunnable);
+    const int count = d->stages.count();
+    if (!count) {
+        qWarning("QQuickCLImageRunnable: runKernel() is not reimplemented and there are no stages");
+        return;
+    }
+
+    // The last consumer of each stage's output. Once it has been enqueued,
+    // the image can be reused by the following stages since the queue is
+    // in-order.
+    QVector<int> lastUse(count, -1);
+    for (int stage = 0; stage < count; ++stage) {
+        foreach (int input, d->stages[stage])
+            if (input != SourceImage)
+                lastUse[input] = stage;
+    }
+
+    QVector<cl_mem> outputs(count, 0);
+    QVector<cl_mem> available = d->intermediates;
+    QVector<cl_mem> inputs;
+    for (int stage = 0; stage < count; ++stage) {
+        cl_mem output = outImage;
+        if (stage < count - 1) {
+            output = available.isEmpty() ? d->createIntermediateImage() : available.takeLast();
+            if (!output)
+                return;
+        }
+        outputs[stage] = output;
+
+        inputs.clear();
+        foreach (int input, d->stages[stage])
+            inputs.append(input == SourceImage ? inImage : outputs[input]);
+
+        // Each stage reads up to the margin beyond the pixels it writes, so
+        // earlier stages have to cover a larger area.
+        if (!d->frameRect.isNull()) {
+            const int m = d->dirtyMargin * (count - 1 - stage);
+            d->stageRect = d->frameRect.adjusted(-m, -m, m, m) & QRect(QPoint(0, 0), size);
+        }
+
+        QQuickCLImageRunnablePrivate::PendingTrace *range = 0;
+        if (d->tracing)
+            range = d->beginTraceRange(QByteArrayLiteral("stage ") + QByteArray::number(stage));
+        runStage(stage, inputs, output, size);
+        d->endTraceRange(range);
+
+        foreach (int input, d->stages[stage]) {
+            if (input != SourceImage && lastUse[input] == stage && !available.contains(outputs[input]))
+                available.append(outputs[input]);
+        }
+        if (stage < count - 1 && lastUse[stage] < 0)
+            available.append(output);
+    }
+}
+
+/*!
+    Called from the default implementation of runKernel() for each stage added
+    via addStage(), in the order the stages were added. \a inputs contains the
+    images specified when adding the stage, \a outImage is either an
+    intermediate image or, for the last stage, the output image. \a size
+    specifies the size of all the images.
+
+    The default implementation does nothing.
+ */
+void QQuickCLImageRunnable::runStage(int stage, const QVector<cl_mem> &inputs, cl_mem outImage, const QSize &size)
+{
+    Q_UNUSED(stage);
+    Q_UNUSED(inputs);
+    Q_UNUSED(outImage);
+    Q_UNUSED(size);
+}
+
+QSGNode *QQuickCLImageRunnable::update(QSGNode *node)
+{
+    Q_D(QQuickCLImageRunnable);
+    if (!d->pendingBuilds.isEmpty()) {
+        foreach (const QQuickCLProgramBuild &build, d->pendingBuilds) {
+            if (!build.isFinished()) {
+                d->stats->addSkippedFrame();
+                return node;
+            }
+        }
+        d->pendingBuilds.clear();
+    }
+
+    if (d->outputFormatChanged) {
+        d->outputFormatChanged = false;
+        d->releaseOutputs();
+        delete node;
+        node = 0;
+    }
+
+    // Commands of a previous frame that was aborted.
+    d->commitTraces();
+    d->harvestProfiling(false);
+    QQuickCLTracer *tracer = QQuickCLTracer::instance();
+    d->tracing = d->profilingQueue && tracer->isEnabled();
+    if (d->tracing && d->traceTrack < 0) {
+        const QByteArray name = d->item->metaObject()->className();
+        d->traceTrack = tracer->addTrack(name + " queue");
+        d->cpuTrack = tracer->addTrack(name + " render thread");
+    }
+    const qint64 cpuStart = d->tracing ? tracer->timestamp() : 0;
+
+    QSGTextureProvider *textureProvider = d->sourceTracker->textureProvider();
+    QSGTexture *texture;
+    if (!textureProvider || !(texture = textureProvider->texture())) {
+        delete node;
+        return 0;
+    }
+
+    QSGDynamicTexture *dtex = qobject_cast<QSGDynamicTexture *>(texture);
+    bool sourceChanged = false;
+    if (dtex) {
+        // Re-rendering a layer writes to the texture the frames in flight
+        // are reading. Nothing else makes OpenGL wait for them.
+        d->harvestRing(true);
+        d->sourceTracker->setUpdatingTexture(true);
+        sourceChanged = dtex->updateTexture();
+        d->sourceTracker->setUpdatingTexture(false);
+    }
+
+    if (!texture->textureId()) { // the texture provider may not be ready yet, try again later
+        d->item->scheduleUpdate();
+        return node;
+    }
+
+    // Everything sized after the working size is recreated when it changes.
+    // Switching between textures does not need any of that.
+    const QSize workSize = d->workingSize(texture->textureSize());
+    const bool sourceReplaced = d->sourceSize != texture->textureSize() || d->textureSize != workSize
+            || d->inputTexture != texture->textureId();
+    if (d->textureSize != workSize)
+        d->releaseImages();
+    if (sourceReplaced)
+        sourceChanged = true;
+    if (d->sourceTracker->takeTextureChanged())
+        sourceChanged = true;
+    const QRect dirty = d->flags.testFlag(PartialUpdates) ? d->takeDirtyRect(texture->textureSize()) : QRect();
+
+    QQuickCLContext *clctx = d->item->context();
+    Q_ASSERT(clctx);
+    cl_int err = 0;
+    const int imageCount = d->flags.testFlag(NoOutputImage) ? 1 : 2;
+    const bool pipelined = d->interop && imageCount == 2 && d->framesInFlight > 1;
+    QQuickCLItemPrivate *itemPriv = QQuickCLItemPrivate::get(d->item);
+    const int generation = itemPriv->updateGeneration.load();
+    const bool generationChanged = generation != d->lastGeneration;
+    const bool inputsChanged = sourceChanged || generationChanged || !dirty.isEmpty();
+    d->lastGeneration = generation;
+
+    if (!pipelined && d->flags.testFlag(SkipUnchanged) && !inputsChanged && d->hasResult
+            && (node || imageCount == 1)) {
+        d->elapsed = 0;
+        return imageCount == 2 ? d->updateNode(node) : 0;
+    }
+
+    if (d->interop) {
+        d->image[0] = d->inputImage(texture, &err);
+        if (!d->image[0]) {
+            if (err == CL_INVALID_GL_OBJECT) // the texture provider may not be ready yet, try again later
+                d->item->scheduleUpdate();
+            else
+                qWarning("Failed to create OpenCL image object from input OpenGL texture: %d", err);
+            return node;
+        }
+    }
+
+    d->inputTexture = texture->textureId();
+    d->sourceSize = texture->textureSize();
+    d->textureSize = workSize;
+    const bool scaled = d->textureSize != d->sourceSize;
+    if (scaled && !d->scaledInput) {
+        const cl_image_format format = { CL_RGBA, CL_UNORM_INT8 };
+        d->scaledInput = clCreateImage2D(clctx->context(), CL_MEM_READ_WRITE, &format,
+                                         workSize.width(), workSize.height(), 0, 0, &err);
+        if (!d->scaledInput) {
+            qWarning("Failed to create scaled input image: %d", err);
+            return node;
+        }
+    }
+
+    int slot = -1;
+    bool outputChanged = false;
+    if (pipelined) {
+        if (d->output.texture) {
+            d->releaseOutputTexture(d->output);
+            d->output.texture = 0;
+            d->output.mem = 0;
+        }
+        if (d->ensureRing(d->textureSize)) {
+            delete node;
+            node = 0;
+        }
+        d->harvestRing(false);
+        // Refreshes scheduled for presenting finished frames must not start
+        // new work, otherwise the item would never stop updating.
+        if (!inputsChanged && d->ringShown >= 0)
+            return d->updateNode(node);
+        slot = d->freeRingSlot();
+        d->image[1] = d->ring[slot].output.mem;
+        if (!d->image[1])
+            return node;
+    } else if (imageCount == 2) {
+        if (!d->ring.isEmpty()) {
+            d->releaseRing();
+            delete node;
+            node = 0;
+            outputChanged = true;
+        }
+        if (d->ensureOutputTexture(d->textureSize)) {
+            delete node;
+            node = 0;
+            outputChanged = true;
+        }
+        if (d->interop) {
+            d->image[1] = d->output.mem;
+            if (!d->image[1])
+                return node;
+        }
+    }
+
+    if (!d->updateStateImages())
+        return node;
+
+    // Only the dirty area needs processing when the rest of the previous
+    // output is still valid. Property changes may affect every pixel.
+    d->frameRect = QRect();
+    if (!dirty.isEmpty() && !pipelined && imageCount == 2 && d->hasResult && !sourceReplaced && !scaled
+            && !generationChanged && !outputChanged && !d->hasPingPongState()) {
+        const int m = d->dirtyMargin * qMax(1, d->stages.count());
+        d->frameRect = dirty.adjusted(-m, -m, m, m) & QRect(QPoint(0, 0), d->textureSize);
+    }
+
+    const qint64 frameStart = d->timer.nsecsElapsed();
+    cl_event *profEv = pipelined ? d->ring[slot].profEv : d->profEv;
+
+    if (d->interop) {
+        cl_event glDone = d->sync->acquireFromGL();
+        err = clEnqueueAcquireGLObjects(d->queue, imageCount, d->image, glDone ? 1 : 0, glDone ? &glDone : 0,
+                                        d->traceEvent("acquire"));
+        if (err != CL_SUCCESS) {
+            qWarning("Failed to queue acquiring the GL textures: %d", err);
+            return node;
+        }
+    } else {
+        if (!d->prepareCopy(clctx) || !d->copyFromTexture(d->inputTexture))
+            return node;
+    }
+    const qint64 acquireEnd = d->timer.nsecsElapsed();
+
+    const bool profiling = d->flags.testFlag(Profile) || d->flags.testFlag(AdaptiveResolution);
+    if (profiling)
+        if (clEnqueueMarker(d->queue, &profEv[0]) != CL_SUCCESS)
+            qWarning("Failed to enqueue profiling marker (start)");
+
+    // The downsampled input is part of the measured time, the upsampling
+    // happens when rendering the node with linear filtering.
+    cl_mem input = d->image[0];
+    if (scaled) {
+        if (!d->resample(d->image[0], d->scaledInput, d->textureSize))
+            qWarning("Failed to scale the input image");
+        input = d->scaledInput;
+    }
+
+    QQuickCLImageRunnablePrivate::PendingTrace *kernels = d->beginTraceRange("runKernel");
+    d->stageRect = d->frameRect;
+    runKernel(input, d->image[1], d->textureSize);
+    d->stageRect = QRect();
+    d->endTraceRange(kernels);
+
+    if (d->interop && imageCount == 2)
+        d->padOutput(d->image[1], d->textureSize, pipelined ? d->ring[slot].output.size : d->output.size);
+
+    for (int i = 0; i < d->stateImages.count(); ++i) {
+        if (d->stateImages[i].pingPong)
+            d->stateImages[i].current ^= 1;
+    }
+
+    if (profiling)
+        if (clEnqueueMarker(d->queue, &profEv[1]) != CL_SUCCESS)
+            qWarning("Failed to enqueue profiling marker (end)");
+
+    const qint64 releaseBegin = d->timer.nsecsElapsed();
+    if (pipelined) {
+        // Only finished frames are shown, see harvestRing(), so OpenGL never
+        // has to wait for this one. Not even on the server side, which would
+        // serialize the kernels with rendering the scene again.
+        cl_event released = 0;
+        const qint64 releaseStart = d->tracing ? tracer->timestamp() : 0;
+        clEnqueueReleaseGLObjects(d->queue, imageCount, d->image, 0, 0, &released);
+        d->traceExistingEvent("release", released, releaseStart);
+        clFlush(d->queue);
+        QQuickCLImageRunnablePrivate::RingSlot &s(d->ring[slot]);
+        s.done = released;
+        s.size = d->textureSize;
+        s.submitted = frameStart;
+        s.serial = ++d->ringSerial;
+        if (d->ringShown < 0)
+            d->harvestRing(true); // nothing to show yet, fill the pipeline
+        else if (released)
+            itemPriv->scheduleRefresh(released);
+    } else if (d->interop) {
+        cl_event released = 0;
+        const bool needsEvent = d->sync->clToGLMethod() != QQuickCLGLSync::Implicit;
+        const qint64 releaseStart = d->tracing ? tracer->timestamp() : 0;
+        clEnqueueReleaseGLObjects(d->queue, imageCount, d->image, 0, 0,
+                                  needsEvent ? &released : d->traceEvent("release"));
+        d->traceExistingEvent("release", released, releaseStart);
+        d->sync->releaseToGL(released);
+        if (released)
+            clReleaseEvent(released);
+    } else {
+        if (imageCount == 2)
+            d->copyToTexture();
+        else
+            clFlush(d->queue);
+        ++d->copyFrame;
+    }
+
+    const qint64 releaseEnd = d->timer.nsecsElapsed();
+
+    if (d->flags.testFlag(ForceCLFinish)) {
+        clFinish(d->queue);
+        d->blockedTime += double(d->timer.nsecsElapsed() - releaseEnd) / 1000000.0;
+    }
+
+    d->reportFrameStats(double(acquireEnd - frameStart) / 1000000.0,
+                        double(releaseEnd - releaseBegin) / 1000000.0);
+    d->endFrameTrace(cpuStart);
+
+    if (pipelined)
+        return d->updateNode(node);
+
+    d->hasResult = true;
+
+    d->latency = double(d->timer.nsecsElapsed() - frameStart) / 1000000.0;
+
+    if (d->profEv[0] && d->profEv[1]) {
+        d->pendingProfiling.append(qMakePair(d->profEv[0], d->profEv[1]));
+    } else {
+        for (int i = 0; i < 2; ++i) {
+            if (d->profEv[i])
+                clReleaseEvent(d->profEv[i]);
+        }
+    }
+    d->profEv[0] = d->profEv[1] = 0;
+    // Without waiting, the results are typically picked up in the next frame.
+    d->harvestProfiling(false);
+
+    if (imageCount == 1)
+        return 0;
+
+    return d->updateNode(node);
+}
+
+/*!
+    Returns the number of milliseconds spent on OpenCL operations for the
+    most recently finished frame.
+
+    Profiling never waits for the OpenCL commands. The results are collected
+    once the frame has finished, typically during the next update(),
+    therefore the value usually refers to an earlier frame than the one just
+    enqueued. See profileStats() for the statistics over several frames.
+
+    \note OpenCL command queue profiling must be enabled by passing the \c Profile
+    flag to the constructor, or by setting the environment variable
+    \c QT_QUICKCL_PROFILE.
+ */
+double QQuickCLImageRunnable::elapsed() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->elapsed;
+}
+
+/*!
+    \return the minimum, average, 95th and 99th percentile and maximum of the
+    times reported by elapsed() for the last profileWindowSize() finished
+    frames. The values are 0 when profiling is not enabled.
+ */
+QQuickCLImageRunnable::ProfileStats QQuickCLImageRunnable::profileStats() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    ProfileStats stats;
+    stats.count = d->profileWindow.count();
+    stats.min = stats.avg = stats.p95 = stats.p99 = stats.max = 0;
+    if (!stats.count)
+        return stats;
+    QVector<double> v = d->profileWindow;
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    foreach (double t, v)
+        sum += t;
+    stats.min = v.first();
+    stats.max = v.last();
+    stats.avg = sum / stats.count;
+    stats.p95 = v[qMin(stats.count - 1, int(stats.count * 0.95))];
+    stats.p99 = v[qMin(stats.count - 1, int(stats.count * 0.99))];
+    return stats;
+}
+
+/*!
+    Sets the number of finished frames considered by profileStats() to
+    \a frames. The default is 120.
+ */
+void QQuickCLImageRunnable::setProfileWindowSize(int frames)
+{
+    Q_D(QQuickCLImageRunnable);
+    d->profileWindowSize = qMax(1, frames);
+    d->profileWindow.clear();
+    d->profileNext = 0;
+}
+
+/*!
+    \return the number of frames considered by profileStats().
+ */
+int QQuickCLImageRunnable::profileWindowSize() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->profileWindowSize;
+}
+
+/*!
+    \return a pointer to pass as the \c event argument of an OpenCL enqueue
+    function in order to record the command under \a name in the
+    QQuickCLTracer timeline, or \c null when tracing is disabled. The event
+    is owned by the runnable. Only valid for commands enqueued to
+    commandQueue() from runKernel() or runStage().
+
+    \code
+        clEnqueueNDRangeKernel(commandQueue(), kernel, 2, 0, workSize, 0, 0, 0, traceEvent("blur"));
+    \endcode
+
+    The stages added via addStage() are traced automatically.
+ */
+cl_event *QQuickCLImageRunnable::traceEvent(const char *name)
+{
+    Q_D(QQuickCLImageRunnable);
+    return d->traceEvent(QByteArray(name));
+}
+
+/*!
+    Sets the maximum number of frames whose OpenCL work may be in flight to
+    \a count. The default is 1, meaning that the results of a frame are shown
+    in the same frame. Higher values increase throughput at the expense of
+    latency, see \l{Frames in flight}.
+
+    \note The value has no effect when CL-GL interop is not available or the
+    runnable was created with the \c NoOutputImage flag.
+ */
+void QQuickCLImageRunnable::setFramesInFlight(int count)
+{
+    Q_D(QQuickCLImageRunnable);
+    d->framesInFlight = qMax(1, count);
+}
+
+/*!
+    \return the maximum number of frames in flight.
+ */
+int QQuickCLImageRunnable::framesInFlight() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->framesInFlight;
+}
+
+/*!
+    Marks \a rect, in source texture pixels, as changed and schedules an
+    update for the item. With the \c PartialUpdates flag the next update
+    only processes the union of the dirty areas, see \l{Partial updates}.
+
+    This function is thread-safe. It can be called from the gui thread, as
+    long as the runnable is alive, or from update().
+ */
+void QQuickCLImageRunnable::addDirtyRect(const QRect &rect)
+{
+    Q_D(QQuickCLImageRunnable);
+    QMutexLocker lock(&d->dirtyMutex);
+    d->dirty |= rect;
+    lock.unlock();
+    QQuickCLItemPrivate::get(d->item)->postUpdate();
+}
+
+/*!
+    Tracks the geometry of \a item, which is expected to be part of the
+    layered source item's subtree. Whenever the area covered by \a item
+    changes, for example due to moving, scaling or rotating it, both the
+    previous and the new area are treated as dirty. Changes to the contents
+    of the item are not detected, use addDirtyRect() for those.
+
+    Must be called on the render thread, typically from the subclass'
+    constructor. Only has an effect with the \c PartialUpdates flag.
+ */
+void QQuickCLImageRunnable::trackItemGeometry(QQuickItem *item)
+{
+    Q_D(QQuickCLImageRunnable);
+    QQuickCLImageRunnablePrivate::TrackedItem t;
+    t.item = item;
+    d->trackedItems.append(t);
+}
+
+/*!
+    Sets the number of \a pixels the kernels read beyond the pixel they
+    write, for example 1 for a 3x3 filter. The dirty area is extended
+    accordingly, and with stages added via addStage() the earlier stages
+    process correspondingly larger areas. The default is 0.
+ */
+void QQuickCLImageRunnable::setDirtyRectMargin(int pixels)
+{
+    Q_D(QQuickCLImageRunnable);
+    d->dirtyMargin = qMax(0, pixels);
+}
+
+/*!
+    \return the margin of the dirty area in pixels.
+ */
+int QQuickCLImageRunnable::dirtyRectMargin() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->dirtyMargin;
+}
+
+/*!
+    Sets the frame time budget used with the \c AdaptiveResolution flag to
+    \a ms milliseconds. The default is 8, leaving half of a 60 Hz frame for
+    the rest of the scene.
+ */
+void QQuickCLImageRunnable::setFrameTimeBudget(double ms)
+{
+    Q_D(QQuickCLImageRunnable);
+    d->frameBudget = qMax(0.1, ms);
+}
+
+/*!
+    \return the frame time budget in milliseconds.
+ */
+double QQuickCLImageRunnable::frameTimeBudget() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->frameBudget;
+}
+
+/*!
+    Sets the lowest factor by which the \c AdaptiveResolution flag may scale
+    down the working size to \a scale, which must be between 0 and 1. The
+    default is 0.25.
+ */
+void QQuickCLImageRunnable::setMinimumScale(double scale)
+{
+    Q_D(QQuickCLImageRunnable);
+    d->minScale = qBound(1.0 / SCALE_STEPS, scale, 1.0);
+    d->scale = qMax(d->scale, d->minScale);
+}
+
+/*!
+    \return the lowest factor for scaling down the working size.
+ */
+double QQuickCLImageRunnable::minimumScale() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->minScale;
+}
+
+/*!
+    \return the factor by which the \c AdaptiveResolution flag currently
+    scales down the working size. This is 1 when the kernels fit into the
+    frame time budget at full resolution.
+ */
+double QQuickCLImageRunnable::resolutionScale() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->scale;
+}
+
+/*!
+    \return the area, in pixels, that runKernel() or the current runStage()
+    has to write. This is the whole image unless the \c PartialUpdates flag
+    is set and only a part of the source has changed.
+
+    \sa enqueueKernel()
+ */
+QRect QQuickCLImageRunnable::dirtyRect() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->stageRect.isNull() ? QRect(QPoint(0, 0), d->textureSize) : d->stageRect;
+}
+
+/*!
+    Enqueues \a kernel as a two-dimensional NDRange covering dirtyRect().
+    The global work offset is set to the top-left corner of the area, so
+    kernels using get_global_id() as the pixel position need no changes.
+    When tracing is enabled, the kernel is recorded under its function name,
+    like the commands registered via traceEvent().
+
+    \return the error code from clEnqueueNDRangeKernel().
+ */
+cl_int QQuickCLImageRunnable::enqueueKernel(cl_kernel kernel)
+{
+    Q_D(QQuickCLImageRunnable);
+    const QRect r = dirtyRect();
+    const size_t offset[] = { size_t(r.x()), size_t(r.y()) };
+    const size_t workSize[] = { size_t(r.width()), size_t(r.height()) };
+    QByteArray name;
+    if (d->tracing) {
+        size_t size = 0;
+        clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, 0, 0, &size);
+        name = QByteArray(int(size), '\0');
+        clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, size, name.data(), 0);
+        name.chop(1); // the terminating null
+    }
+    cl_int err = clEnqueueNDRangeKernel(d->queue, kernel, 2, offset, workSize, 0, 0, 0, d->traceEvent(name));
+    if (err != CL_SUCCESS)
+        qWarning("Failed to enqueue kernel: %d", err);
+    return err;
+}
+
+/*!
+    Returns the number of milliseconds between enqueuing the OpenCL work for
+    the currently shown result and the update() that passed it to the
+    scenegraph. With a single frame in flight this is the time spent in
+    update() for enqueuing and synchronizing the work. Unlike elapsed(), this
+    does not require profiling.
+ */
+double QQuickCLImageRunnable::latency() const
+{
+    Q_D(const QQuickCLImageRunnable);
+    return d->latency;
+}
+
+static QMetaMethod trackerSlot(const char *signature)
+{
+    const QMetaObject *mo = &QQuickCLSourceTracker::staticMetaObject;
+    return mo->method(mo->indexOfSlot(signature));
+}
+
+QQuickCLSourceTracker::QQuickCLSourceTracker(QQuickCLItem *item, const QByteArray &propertyName)
+    : m_item(item),
+      m_source(0),
+      m_provider(0),
+      m_sourceDirty(1),
+      m_textureChanged(1),
+      m_updateOnTextureChange(false),
+      m_updatingTexture(false)
+{
+    setPropertyName(propertyName);
+}
+
+void QQuickCLSourceTracker::setPropertyName(const QByteArray &propertyName)
+{
+    if (m_property.hasNotifySignal())
+        disconnect(m_item, m_property.notifySignal(), this, trackerSlot("invalidateSource()"));
+    const QMetaObject *mo = m_item->metaObject();
+    const int index = mo->indexOfProperty(propertyName.constData());
+    m_property = index >= 0 ? mo->property(index) : QMetaProperty();
+    if (m_property.hasNotifySignal())
+        connect(m_item, m_property.notifySignal(), this, trackerSlot("invalidateSource()"), Qt::DirectConnection);
+    else if (index < 0)
+        qWarning("QQuickCLImageRunnable: No property %s in %s", propertyName.constData(), mo->className());
+    m_sourceDirty.store(1);
+}
+
+// Called on the render thread while the gui thread is blocked. Properties
+// without a notify signal are read on every call.
+QSGTextureProvider *QQuickCLSourceTracker::textureProvider()
+{
+    if (m_sourceDirty.testAndSetOrdered(1, 0) || !m_property.hasNotifySignal()) {
+        QQuickItem *source = m_property.isValid() ? m_property.read(m_item).value<QQuickItem *>() : 0;
+        if (source != m_source) {
+            if (m_source)
+                disconnect(m_source, SIGNAL(destroyed()), this, SLOT(sourceDestroyed()));
+            if (source)
+                connect(source, SIGNAL(destroyed()), this, SLOT(sourceDestroyed()), Qt::DirectConnection);
+            m_source = source;
+        }
+    }
+
+    // Items may switch providers without notice, for example when enabling a
+    // layer. Asking for the provider is cheap once it exists.
+    QSGTextureProvider *provider = m_source && m_source->isTextureProvider() ? m_source->textureProvider() : 0;
+    if (provider != m_provider) {
+        if (m_provider)
+            disconnect(m_provider, 0, this, 0);
+        if (provider) {
+            connect(provider, SIGNAL(textureChanged()), this, SLOT(markTextureChanged()), Qt::DirectConnection);
+            connect(provider, SIGNAL(destroyed()), this, SLOT(textureProviderDestroyed()), Qt::DirectConnection);
+        }
+        m_provider = provider;
+        m_textureChanged.store(1);
+    }
+    return m_provider;
+}
+
+// Returns true when the texture provider has signaled textureChanged() or has
+// been replaced since the previous call.
+bool QQuickCLSourceTracker::takeTextureChanged()
+{
+    return m_textureChanged.fetchAndStoreOrdered(0) != 0;
+}
+
+void QQuickCLSourceTracker::invalidateSource()
+{
+    m_sourceDirty.store(1);
+}
+
+void QQuickCLSourceTracker::sourceDestroyed()
+{
+    m_source = 0;
+    m_sourceDirty.store(1);
+}
+
+// Layers signal this after being rendered again. With partial updates the
+// item is refreshed without marking all of its inputs as changed, unless the
+// layer was rendered by the runnable's own update(), which already handles
+// the change.
+void QQuickCLSourceTracker::markTextureChanged()
+{
+    m_textureChanged.store(1);
+    if (m_updateOnTextureChange && !m_updatingTexture)
+        QQuickCLItemPrivate::get(m_item)->postUpdate();
+}
+
+void QQuickCLSourceTracker::textureProviderDestroyed()
+{
+    m_provider = 0;
+    m_textureChanged.store(1);
 }
 
 QT_END_NAMESPACE
@@ -39,11 +39,15 @@
 
 #include <QtQuickCL/qtquickclglobal.h>
 #include <QtQuickCL/qquickclrunnable.h>
+#include <QtQuickCL/qquickclcontext.h>
+#include <QtCore/qvector.h>
+#include <QtCore/qrect.h>
 
 QT_BEGIN_NAMESPACE
 
 class QQuickCLImageRunnablePrivate;
 class QQuickCLItem;
+class QQuickItem;
 
 class Q_QUICKCL_EXPORT QQuickCLImageRunnable : public QQuickCLRunnable
 {
@@ -53,10 +57,24 @@ public:
     enum Flag {
         NoOutputImage = 0x01,
         Profile = 0x02,
-        ForceCLFinish = 0x04
+        ForceCLFinish = 0x04,
+        SkipUnchanged = 0x08,
+        PartialUpdates = 0x10,
+        ScaleToItemSize = 0x20,
+        AdaptiveResolution = 0x40
     };
     Q_DECLARE_FLAGS(Flags, Flag)
 
+    enum StageInput {
+        SourceImage = -1
+    };
+
+    enum StateImagePolicy {
+        KeepContents,
+        ClearContents,
+        RescaleContents
+    };
+
     QQuickCLImageRunnable(QQuickCLItem *item, Flags flags = 0);
     ~QQuickCLImageRunnable();
 
@@ -64,10 +82,58 @@ public:
 
     void setSourcePropertyName(const QByteArray &name);
 
-    double elapsed() const;
+    void setOutputFormat(QOpenGLTexture::TextureFormat format);
+    QOpenGLTexture::TextureFormat outputFormat() const;
+
+    void setFramesInFlight(int count);
+    int framesInFlight() const;
+
+    void addDirtyRect(const QRect &rect);
+    void trackItemGeometry(QQuickItem *item);
+    void setDirtyRectMargin(int pixels);
+    int dirtyRectMargin() const;
+
+    void setFrameTimeBudget(double ms);
+    double frameTimeBudget() const;
+    void setMinimumScale(double scale);
+    double minimumScale() const;
+    double resolutionScale() const;
+
+    double elapsed() const Q_DECL_OVERRIDE;
+    double latency() const;
+
+    struct ProfileStats {
+        int count;
+        double min;
+        double avg;
+        double p95;
+        double p99;
+        double max;
+    };
+    ProfileStats profileStats() const;
+    void setProfileWindowSize(int frames);
+    int profileWindowSize() const;
 
 protected:
-    virtual void runKernel(cl_mem inImage, cl_mem outImage, const QSize &size) = 0;
+    void addProgramBuild(const QQuickCLProgramBuild &build);
+
+    int addStage();
+    int addStage(const QVector<int> &inputs);
+    int stageCount() const;
+    void setIntermediateImageFormat(const cl_image_format &format);
+
+    int addStateImage(StateImagePolicy policy = ClearContents, bool pingPong = false);
+    int addStateImage(StateImagePolicy policy, bool pingPong, const cl_image_format &format);
+    cl_mem stateImage(int index) const;
+    cl_mem nextStateImage(int index) const;
+
+    cl_event *traceEvent(const char *name);
+
+    QRect dirtyRect() const;
+    cl_int enqueueKernel(cl_kernel kernel);
+
+    virtual void runKernel(cl_mem inImage, cl_mem outImage, const QSize &size);
+    virtual void runStage(int stage, const QVector<cl_mem> &inputs, cl_mem outImage, const QSize &size);
 
 private:
     QSGNode *update(QSGNode *node) Q_DECL_OVERRIDE;
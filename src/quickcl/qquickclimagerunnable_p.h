@@ -0,0 +1,99 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QQUICKCLIMAGERUNNABLE_P_H
+#define QQUICKCLIMAGERUNNABLE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/QObject>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMetaProperty>
+
+QT_BEGIN_NAMESPACE
+
+class QQuickItem;
+class QQuickCLItem;
+class QSGTextureProvider;
+
+// Keeps track of the source item and its texture provider so that the per
+// frame path does not have to go through the metaobject system. The slots
+// are invoked via direct connections, on the gui thread for the source
+// property and typically on the render thread for the texture provider.
+class QQuickCLSourceTracker : public QObject
+{
+    Q_OBJECT
+
+public:
+    QQuickCLSourceTracker(QQuickCLItem *item, const QByteArray &propertyName);
+
+    void setPropertyName(const QByteArray &propertyName);
+    QSGTextureProvider *textureProvider();
+    QQuickItem *source() const { return m_source; }
+    bool takeTextureChanged();
+    void setUpdateOnTextureChange(bool enable) { m_updateOnTextureChange = enable; }
+    void setUpdatingTexture(bool updating) { m_updatingTexture = updating; }
+
+private slots:
+    void invalidateSource();
+    void sourceDestroyed();
+    void textureProviderDestroyed();
+    void markTextureChanged();
+
+private:
+    QQuickCLItem *m_item;
+    QMetaProperty m_property;
+    QQuickItem *m_source;
+    QSGTextureProvider *m_provider;
+    QAtomicInt m_sourceDirty;
+    QAtomicInt m_textureChanged;
+    bool m_updateOnTextureChange;
+    bool m_updatingTexture;
+};
+
+QT_END_NAMESPACE
+
+#endif
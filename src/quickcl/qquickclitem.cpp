@@ -34,13 +34,13 @@
 **
 ****************************************************************************/
 
-#include "qquickclitem.h"
+#include "qquickclitem_p.h"
 #include "qquickclcontext.h"
+#include "qquickclstats_p.h"
 #include <QtCore/QAtomicInt>
 #include <QtCore/QHash>
 #include <QtCore/QFile>
 #include <QtCore/QLoggingCategory>
-#include <QtQuick/private/qquickitem_p.h>
 
 QT_BEGIN_NAMESPACE
 
@@ -52,12 +52,17 @@ Q_DECLARE_LOGGING_CATEGORY(logCL)
     \brief QQuickCLItem is a QQuickItem that automatically gets an OpenCL
     context with the proper platform and device chosen for CL-GL interop.
 
-    Each instance of QQuickCLItem is backed by a QQuickCLContext and
-    QQuickCLRunnable instance.
-
-     \note When animating properties that are used in OpenCL kernels, call the
-     \l{QQuickItem::update()}{update()} function (from the gui thread) to
-     trigger updates.
+    Each instance of QQuickCLItem is backed by a QQuickCLRunnable instance and
+    a QQuickCLContext. The context is acquired via
+    QQuickCLContext::acquireShared() and is therefore shared between all items
+    rendered with OpenGL contexts in the same share group. This means that
+    OpenCL memory objects created by one item can be used by the others.
+
+     \note When animating properties that are used in OpenCL kernels, call
+     scheduleUpdate() to trigger updates. \l{QQuickItem::update()}{update()}
+     only presents the item again: runnables that skip unchanged frames or
+     keep frames in flight, like QQuickCLImageRunnable, do not treat it as a
+     change of the inputs.
  */
 
 /*!
@@ -94,6 +99,11 @@ Q_DECLARE_LOGGING_CATEGORY(logCL)
     \note When necessary, future updates for the QQuickCLItem can also be
     scheduled from this function. However, this requires calling
     QQuickCLItem::scheduleUpdate() instead of QQuickItem::update().
+
+    \note Building OpenCL programs in the constructor blocks the render thread.
+    Consider using QQuickCLContext::buildProgramAsync() and returning the
+    previous node (or \c null) from this function until the build has
+    finished.
  */
 
 /*!
@@ -102,23 +112,24 @@ Q_DECLARE_LOGGING_CATEGORY(logCL)
     Factory function invoked on the render thread after initializing OpenCL.
  */
 
-class QQuickCLItemPrivate : public QQuickItemPrivate
-{
-    Q_DECLARE_PUBLIC(QQuickCLItem)
-
-public:
-    QQuickCLItemPrivate() : clctx(0), clnode(0) { }
-
-    static void CL_CALLBACK eventCallback(cl_event event, cl_int status, void *user_data);
-
-    QQuickCLContext *clctx;
-    QQuickCLRunnable *clnode;
-};
-
 QQuickCLItem::QQuickCLItem(QQuickItem *parent)
     : QQuickItem(*new QQuickCLItemPrivate, parent)
 {
+    Q_D(QQuickCLItem);
     setFlag(ItemHasContents);
+    d->completions = new QQuickCLCompletionQueue(this);
+    d->stats = new QQuickCLStats(this);
+}
+
+QQuickCLItem::~QQuickCLItem()
+{
+    Q_D(QQuickCLItem);
+    if (QQuickCLUpdateDispatcher *dispatcher = d->dispatcher.load())
+        dispatcher->cancel(this);
+    // Events completing after this point are dropped. The queue stays alive
+    // until all callbacks have run.
+    d->completions->detach();
+    d->completions->deref();
 }
 
 /*!
@@ -134,6 +145,20 @@ QQuickCLContext *QQuickCLItem::context() const
     return d->clctx;
 }
 
+/*!
+  \return the performance statistics of the item. The object is owned by the
+  item and also reports to the aggregate statistics of the item's window,
+  see QQuickCLStats::forWindow().
+
+  It is safe to call this function on any thread. Runnables report their
+  numbers to it from the render thread.
+ */
+QQuickCLStats *QQuickCLItem::clStats() const
+{
+    Q_D(const QQuickCLItem);
+    return d->stats;
+}
+
 QSGNode *QQuickCLItem::updatePaintNode(QSGNode *node, UpdatePaintNodeData *)
 {
     Q_D(QQuickCLItem);
@@ -145,21 +170,21 @@ QSGNode *QQuickCLItem::updatePaintNode(QSGNode *node, UpdatePaintNodeData *)
 
     // render thread, initialize CL if not yet done
     if (!d->clctx) {
-        d->clctx = new QQuickCLContext;
-        if (!d->clctx->create()) {
+        d->clctx = QQuickCLContext::acquireShared();
+        if (!d->clctx)
             qWarning("Failed to create OpenCL context");
-            delete d->clctx;
-            d->clctx = 0;
-        }
     }
 
     if (!d->clctx)
         return 0;
 
+    // Programs built synchronously from here are accounted to this item.
+    QQuickCLStatsPrivate::setCurrent(d->stats);
     if (!d->clnode)
         d->clnode = createCL();
-
-    return d->clnode ? d->clnode->update(node) : 0;
+    node = d->clnode ? d->clnode->update(node) : 0;
+    QQuickCLStatsPrivate::setCurrent(0);
+    return node;
 }
 
 class ReleaseRunnable : public QRunnable
@@ -168,7 +193,7 @@ public:
     ReleaseRunnable(QQuickCLContext *clctx, QQuickCLRunnable *clnode) : clctx(clctx), clnode(clnode) { }
     void run() Q_DECL_OVERRIDE {
         delete clnode;
-        delete clctx;
+        QQuickCLContext::releaseShared(clctx);
     }
 private:
     QQuickCLContext *clctx;
@@ -182,6 +207,7 @@ void QQuickCLItem::releaseResources()
     window()->scheduleRenderJob(new ReleaseRunnable(d->clctx, d->clnode), QQuickWindow::BeforeSynchronizingStage);
     d->clnode = 0;
     d->clctx = 0;
+    d->stats->setMemoryBytes(0);
 }
 
 void QQuickCLItem::invalidateSceneGraph()
@@ -190,48 +216,121 @@ void QQuickCLItem::invalidateSceneGraph()
     Q_D(QQuickCLItem);
     delete d->clnode;
     d->clnode = 0;
-    delete d->clctx;
+    QQuickCLContext::releaseShared(d->clctx);
     d->clctx = 0;
+    d->stats->setMemoryBytes(0);
 }
 
 static const int EV_UPDATE = QEvent::User + 128;
 static const int EV_EVENT = QEvent::User + 129;
-
-class EventCompleteEvent : public QEvent
-{
-public:
-    EventCompleteEvent(cl_event event) : QEvent(QEvent::Type(EV_EVENT)), event(event) { }
-    cl_event event;
-};
+static const int EV_DISPATCH = QEvent::User + 130;
 
 bool QQuickCLItem::event(QEvent *e)
 {
     if (e->type() == EV_UPDATE) {
+        Q_D(QQuickCLItem);
+        d->updatePending.store(0);
         update();
         return true;
     } else if (e->type() == EV_EVENT) {
-        EventCompleteEvent *ev = static_cast<EventCompleteEvent *>(e);
-        eventCompleted(ev->event);
+        Q_D(QQuickCLItem);
+        d->deliverCompletions();
         return true;
     }
     return QQuickItem::event(e);
 }
 
 /*!
-    Schedules an update for the item. Unlike \l{QQuickItem::update()}{the base
-    class' update()}, this is safe to be called on any thread, hence it is safe
-    for use from CL event callbacks.
+    Schedules an update for the item, indicating that the inputs of the
+    computation have changed. Property setters are expected to call this
+    function instead of \l{QQuickItem::update()}{the base class' update()},
+    which is treated as a refresh that presents the item again. Unlike
+    update(), this is safe to be called on any thread, hence it is safe for
+    use from CL event callbacks.
+
+    Calling this function repeatedly before the update is processed is cheap:
+    at most one update is outstanding per item, and the updates of all items
+    in the same window are delivered with a single event.
  */
 void QQuickCLItem::scheduleUpdate()
 {
-    QCoreApplication::postEvent(this, new QEvent(QEvent::Type(EV_UPDATE)));
+    Q_D(QQuickCLItem);
+    d->updateGeneration.ref();
+    d->postUpdate();
 }
 
-struct EventCallbackParam
+void QQuickCLItem::itemChange(ItemChange change, const ItemChangeData &value)
 {
-    EventCallbackParam(QQuickCLItem *item) : item(item) { }
-    QPointer<QQuickCLItem> item;
-};
+    if (change == ItemSceneChange) {
+        // gui thread, pending updates are for the old window
+        Q_D(QQuickCLItem);
+        if (QQuickCLUpdateDispatcher *dispatcher = d->dispatcher.load())
+            dispatcher->cancel(this);
+        d->updatePending.store(0);
+        d->dispatcher.store(value.window ? QQuickCLUpdateDispatcher::forWindow(value.window) : 0);
+        QQuickCLStatsPrivate::get(d->stats)->setAggregate(value.window ? QQuickCLStats::forWindow(value.window) : 0);
+    }
+    QQuickItem::itemChange(change, value);
+}
+
+void QQuickCLItemPrivate::postUpdate()
+{
+    Q_Q(QQuickCLItem);
+    if (!updatePending.testAndSetOrdered(0, 1))
+        return;
+    if (QQuickCLUpdateDispatcher *d = dispatcher.load())
+        d->schedule(q);
+    else
+        QCoreApplication::postEvent(q, new QEvent(QEvent::Type(EV_UPDATE)));
+}
+
+QQuickCLUpdateDispatcher::QQuickCLUpdateDispatcher(QQuickWindow *window)
+    : QObject(window)
+{
+    setObjectName(QStringLiteral("_q_quickcl_updatedispatcher"));
+}
+
+// Returns the dispatcher for window, creating it when needed. Called on the
+// gui thread only. The dispatcher is owned by the window.
+QQuickCLUpdateDispatcher *QQuickCLUpdateDispatcher::forWindow(QQuickWindow *window)
+{
+    QObject *obj = window->findChild<QObject *>(QStringLiteral("_q_quickcl_updatedispatcher"),
+                                                Qt::FindDirectChildrenOnly);
+    return obj ? static_cast<QQuickCLUpdateDispatcher *>(obj) : new QQuickCLUpdateDispatcher(window);
+}
+
+// Called on any thread. Only the first item scheduled after the previous
+// dispatch posts an event.
+void QQuickCLUpdateDispatcher::schedule(QQuickCLItem *item)
+{
+    QMutexLocker lock(&mutex);
+    items.append(item);
+    if (items.count() == 1)
+        QCoreApplication::postEvent(this, new QEvent(QEvent::Type(EV_DISPATCH)));
+}
+
+void QQuickCLUpdateDispatcher::cancel(QQuickCLItem *item)
+{
+    QMutexLocker lock(&mutex);
+    items.removeAll(item);
+}
+
+bool QQuickCLUpdateDispatcher::event(QEvent *e)
+{
+    if (e->type() != EV_DISPATCH)
+        return QObject::event(e);
+
+    QVector<QQuickCLItem *> pending;
+    {
+        QMutexLocker lock(&mutex);
+        pending.swap(items);
+    }
+    foreach (QQuickCLItem *item, pending) {
+        QQuickCLItemPrivate::get(item)->updatePending.store(0);
+        item->update();
+    }
+    return true;
+}
 
 /*!
     Registers an event callback for \a event. The virtual function
@@ -245,14 +344,17 @@ struct EventCallbackParam
     destroying the QQuickCLItem before completing the event are also handled
     gracefully.
 
+    Watching events is cheap: the completions are collected without locking
+    or allocating memory in the common case, and all events that completed
+    since the last delivery are passed to eventCompleted() in one go, in the
+    order they completed.
+
     \note \a event is not released.
  */
 void QQuickCLItem::watchEvent(cl_event event)
 {
-    EventCallbackParam *param = new EventCallbackParam(this);
-    cl_int err = clSetEventCallback(event, CL_COMPLETE, QQuickCLItemPrivate::eventCallback, param);
-    if (err != CL_SUCCESS)
-        qWarning("Failed to set event callback: %d", err);
+    Q_D(QQuickCLItem);
+    d->completions->watch(event, false);
 }
 
 /*!
@@ -264,18 +366,176 @@ void QQuickCLItem::eventCompleted(cl_event event)
     Q_UNUSED(event);
 }
 
-void CL_CALLBACK QQuickCLItemPrivate::eventCallback(cl_event event, cl_int status, void *user_data)
+// Schedules an update once event completes, without marking the inputs of the
+// computation as changed. Used to present results computed asynchronously.
+void QQuickCLItemPrivate::scheduleRefresh(cl_event event)
+{
+    completions->watch(event, true);
+}
+
+void QQuickCLItemPrivate::deliverCompletions()
 {
-    if (status != CL_COMPLETE)
+    Q_Q(QQuickCLItem);
+    QQuickCLCompletionQueue::Node *first = completions->takeCompleted();
+    if (!first)
         return;
-    EventCallbackParam *param = static_cast<EventCallbackParam *>(user_data);
-    if (!param->item.isNull())
-        QCoreApplication::postEvent(param->item, new EventCompleteEvent(event));
-    delete param;
+    QQuickCLCompletionQueue::Node *last = first;
+    bool needsRefresh = false;
+    for (QQuickCLCompletionQueue::Node *node = first; node; node = node->next) {
+        if (node->refresh)
+            needsRefresh = true;
+        else
+            q->eventCompleted(node->event);
+        last = node;
+    }
+    completions->recycle(first, last);
+    if (needsRefresh)
+        q->update();
+}
+
+/*
+    A multiple producer, single consumer queue of completed events. OpenCL
+    callbacks, which may run on arbitrary threads, push the nodes onto a
+    lock-free stack and the gui thread takes all of them at once. Only the
+    push making the stack non-empty posts an event to the item, this and the
+    item's destruction are the only places where the mutex is taken.
+
+    Nodes are recycled via a second lock-free stack. Popping single nodes from
+    a lock-free stack is prone to the ABA problem, therefore the whole pool is
+    taken and the remainder pushed back.
+
+    The queue is reference counted, each node waiting for its callback holds a
+    reference. This keeps the queue alive when the item is destroyed before
+    the events complete.
+ */
+QQuickCLCompletionQueue::QQuickCLCompletionQueue(QQuickCLItem *item)
+    : ref(1),
+      completed(0),
+      pool(0),
+      item(item)
+{
+}
+
+QQuickCLCompletionQueue::~QQuickCLCompletionQueue()
+{
+    for (int i = 0; i < 2; ++i) {
+        Node *node = (i ? pool : completed).load();
+        while (node) {
+            Node *next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+}
+
+void QQuickCLCompletionQueue::push(QAtomicPointer<Node> &stack, Node *first, Node *last)
+{
+    Node *head;
+    do {
+        head = stack.loadAcquire();
+        last->next = head;
+    } while (!stack.testAndSetRelease(head, first));
+}
+
+bool QQuickCLCompletionQueue::watch(cl_event event, bool refresh)
+{
+    Node *node = pool.fetchAndStoreAcquire(0);
+    if (node) {
+        if (Node *rest = node->next) {
+            Node *last = rest;
+            while (last->next)
+                last = last->next;
+            push(pool, rest, last);
+        }
+    } else {
+        node = new Node;
+    }
+    node->event = event;
+    node->refresh = refresh;
+    node->queue = this;
+    node->next = 0;
+
+    ref.ref();
+    cl_int err = clSetEventCallback(event, CL_COMPLETE, callback, node);
+    if (err != CL_SUCCESS) {
+        qWarning("Failed to set event callback: %d", err);
+        push(pool, node, node);
+        deref();
+        return false;
+    }
+    return true;
+}
+
+void CL_CALLBACK QQuickCLCompletionQueue::callback(cl_event, cl_int status, void *user_data)
+{
+    Node *node = static_cast<Node *>(user_data);
+    QQuickCLCompletionQueue *q = node->queue;
+    if (status != CL_COMPLETE) {
+        // The command was terminated abnormally, there is nothing to deliver.
+        push(q->pool, node, node);
+    } else {
+        Node *head;
+        do {
+            head = q->completed.loadAcquire();
+            node->next = head;
+        } while (!q->completed.testAndSetRelease(head, node));
+        // node must not be touched anymore, the gui thread may have taken it.
+        if (!head) {
+            QMutexLocker lock(&q->mutex);
+            if (q->item)
+                QCoreApplication::postEvent(q->item, new QEvent(QEvent::Type(EV_EVENT)));
+        }
+    }
+    q->deref();
+}
+
+// Called on the gui thread when the item is destroyed.
+void QQuickCLCompletionQueue::detach()
+{
+    QMutexLocker lock(&mutex);
+    item = 0;
+}
+
+void QQuickCLCompletionQueue::deref()
+{
+    if (!ref.deref())
+        delete this;
+}
+
+// Returns the completed nodes in completion order.
+QQuickCLCompletionQueue::Node *QQuickCLCompletionQueue::takeCompleted()
+{
+    Node *node = completed.fetchAndStoreAcquire(0);
+    Node *reversed = 0;
+    while (node) {
+        Node *next = node->next;
+        node->next = reversed;
+        reversed = node;
+        node = next;
+    }
+    return reversed;
+}
+
+void QQuickCLCompletionQueue::recycle(Node *first, Node *last)
+{
+    push(pool, first, last);
 }
 
 QQuickCLRunnable::~QQuickCLRunnable()
 {
 }
 
+/*!
+    \return the time in milliseconds spent executing OpenCL commands during the
+    last update(), or 0 when this information is not available.
+
+    Implementations that profile their command queues reimplement this
+    function. It is used by QQuickCLOffscreenScene to report per-frame OpenCL
+    times. The default implementation returns 0.
+ */
+double QQuickCLRunnable::elapsed() const
+{
+    return 0;
+}
+
 QT_END_NAMESPACE
@@ -39,6 +39,7 @@
 
 #include <QtQuickCL/qtquickclglobal.h>
 #include <QtQuickCL/qquickclrunnable.h>
+#include <QtQuickCL/qquickclstats.h>
 #include <QtQuick/qquickitem.h>
 
 QT_BEGIN_NAMESPACE
@@ -50,11 +51,14 @@ class Q_QUICKCL_EXPORT QQuickCLItem : public QQuickItem
 {
     Q_OBJECT
     Q_DECLARE_PRIVATE(QQuickCLItem)
+    Q_PROPERTY(QQuickCLStats *clStats READ clStats CONSTANT)
 
 public:
     QQuickCLItem(QQuickItem *parent = 0);
+    ~QQuickCLItem();
 
     QQuickCLContext *context() const;
+    QQuickCLStats *clStats() const;
 
     void scheduleUpdate();
 
@@ -70,6 +74,7 @@ private slots:
 private:
     QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *) Q_DECL_OVERRIDE;
     void releaseResources() Q_DECL_OVERRIDE;
+    void itemChange(ItemChange change, const ItemChangeData &value) Q_DECL_OVERRIDE;
     bool event(QEvent *) Q_DECL_OVERRIDE;
 };
 
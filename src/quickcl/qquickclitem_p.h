@@ -0,0 +1,133 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef QQUICKCLITEM_P_H
+#define QQUICKCLITEM_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qquickclitem.h"
+#include <QtQuick/private/qquickitem_p.h>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QQuickCLUpdateDispatcher : public QObject
+{
+public:
+    static QQuickCLUpdateDispatcher *forWindow(QQuickWindow *window);
+
+    void schedule(QQuickCLItem *item);
+    void cancel(QQuickCLItem *item);
+
+protected:
+    bool event(QEvent *e) Q_DECL_OVERRIDE;
+
+private:
+    QQuickCLUpdateDispatcher(QQuickWindow *window);
+
+    QMutex mutex;
+    QVector<QQuickCLItem *> items;
+};
+
+class QQuickCLCompletionQueue
+{
+public:
+    struct Node {
+        cl_event event;
+        bool refresh;
+        QQuickCLCompletionQueue *queue;
+        Node *next;
+    };
+
+    QQuickCLCompletionQueue(QQuickCLItem *item);
+
+    bool watch(cl_event event, bool refresh);
+    void detach();
+    void deref();
+    Node *takeCompleted();
+    void recycle(Node *first, Node *last);
+
+private:
+    ~QQuickCLCompletionQueue();
+    static void CL_CALLBACK callback(cl_event event, cl_int status, void *user_data);
+    static void push(QAtomicPointer<Node> &stack, Node *first, Node *last);
+
+    QAtomicInt ref;
+    QAtomicPointer<Node> completed;
+    QAtomicPointer<Node> pool;
+    QMutex mutex;
+    QQuickCLItem *item;
+};
+
+class QQuickCLItemPrivate : public QQuickItemPrivate
+{
+    Q_DECLARE_PUBLIC(QQuickCLItem)
+
+public:
+    QQuickCLItemPrivate() : clctx(0), clnode(0), completions(0), stats(0), dispatcher(0) { }
+
+    static QQuickCLItemPrivate *get(QQuickCLItem *item) { return item->d_func(); }
+
+    void postUpdate();
+    void scheduleRefresh(cl_event event);
+    void deliverCompletions();
+
+    QQuickCLContext *clctx;
+    QQuickCLRunnable *clnode;
+    QQuickCLCompletionQueue *completions;
+    QQuickCLStats *stats;
+    // Incremented by scheduleUpdate(), but not for the plain updates and the
+    // refreshes requested internally via postUpdate() or scheduleRefresh().
+    QAtomicInt updateGeneration;
+    // Set while an update is posted but not yet processed.
+    QAtomicInt updatePending;
+    QAtomicPointer<QQuickCLUpdateDispatcher> dispatcher;
+};
+
+QT_END_NAMESPACE
+
+#endif
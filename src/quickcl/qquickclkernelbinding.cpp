@@ -0,0 +1,379 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qquickclkernelbinding.h"
+#include "qquickclitem.h"
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMetaProperty>
+#include <QtCore/QVarLengthArray>
+#include <QtCore/QVector>
+#include <QtGui/QColor>
+#include <QtGui/QVector2D>
+#include <QtGui/QVector4D>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(logCL)
+
+/*!
+    \class QQuickCLKernelBinding
+
+    \brief QQuickCLKernelBinding sets kernel arguments from the properties of
+    a QQuickCLItem.
+
+    Passing property values to kernels usually involves reading the properties
+    and calling \c clSetKernelArg() for each of them on every frame.
+    QQuickCLKernelBinding maps properties to kernel arguments once and then
+    only updates the arguments whose values have changed since the last
+    launch:
+
+    \code
+        m_binding = new QQuickCLKernelBinding(m_item, kernel);
+        m_binding->bind(2, "factor", QQuickCLKernelBinding::Float);
+        ...
+        // in runKernel() or runStage()
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &inImage);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), &outImage);
+        m_binding->apply();
+    \endcode
+
+    Instead of declaring the arguments one by one, bindFromArgInfo() binds all
+    arguments passed by value to the properties with the same name. This
+    requires OpenCL 1.2 and a program built with the \c -cl-kernel-arg-info
+    option.
+
+    The properties are read in apply(), which must be called on the render
+    thread while the gui thread is blocked, for example from
+    QQuickCLRunnable::update() or the functions called from there, like
+    QQuickCLImageRunnable::runKernel(). This way the values used by a launch
+    form a consistent snapshot of the item's state.
+
+    The supported property types are integers, \c float and \c double for the
+    scalar argument types, QPoint, QSize, QPointF, QSizeF and QVector2D for the
+    two component types, and QColor, QRectF and QVector4D for \c float4.
+ */
+
+class QQuickCLKernelBindingPrivate
+{
+public:
+    QQuickCLKernelBindingPrivate(QQuickCLItem *item, cl_kernel kernel)
+        : item(item),
+          kernel(kernel)
+    { }
+
+    struct Binding {
+        int index;
+        QQuickCLKernelBinding::ArgType type;
+        QMetaProperty property;
+        bool valid;
+        uchar value[16];
+    };
+
+    QQuickCLItem *item;
+    cl_kernel kernel;
+    QVector<Binding> bindings;
+};
+
+static size_t argSize(QQuickCLKernelBinding::ArgType type)
+{
+    switch (type) {
+    case QQuickCLKernelBinding::Int2:
+    case QQuickCLKernelBinding::Float2:
+        return 8;
+    case QQuickCLKernelBinding::Float4:
+        return 16;
+    default:
+        return 4;
+    }
+}
+
+static void toArg(const QVariant &v, QQuickCLKernelBinding::ArgType type, uchar *dst)
+{
+    switch (type) {
+    case QQuickCLKernelBinding::Int: {
+        const cl_int i = v.toInt();
+        memcpy(dst, &i, sizeof(i));
+        break;
+    }
+    case QQuickCLKernelBinding::Int2: {
+        cl_int i[2];
+        if (v.userType() == QMetaType::QSize) {
+            const QSize s = v.toSize();
+            i[0] = s.width();
+            i[1] = s.height();
+        } else {
+            const QPoint p = v.toPoint();
+            i[0] = p.x();
+            i[1] = p.y();
+        }
+        memcpy(dst, i, sizeof(i));
+        break;
+    }
+    case QQuickCLKernelBinding::UInt: {
+        const cl_uint u = v.toUInt();
+        memcpy(dst, &u, sizeof(u));
+        break;
+    }
+    case QQuickCLKernelBinding::Float: {
+        const cl_float f = v.toFloat();
+        memcpy(dst, &f, sizeof(f));
+        break;
+    }
+    case QQuickCLKernelBinding::Float2: {
+        cl_float f[2];
+        if (v.userType() == QMetaType::QVector2D) {
+            const QVector2D vec = v.value<QVector2D>();
+            f[0] = vec.x();
+            f[1] = vec.y();
+        } else if (v.userType() == QMetaType::QSizeF || v.userType() == QMetaType::QSize) {
+            const QSizeF s = v.toSizeF();
+            f[0] = s.width();
+            f[1] = s.height();
+        } else {
+            const QPointF p = v.toPointF();
+            f[0] = p.x();
+            f[1] = p.y();
+        }
+        memcpy(dst, f, sizeof(f));
+        break;
+    }
+    case QQuickCLKernelBinding::Float4: {
+        cl_float f[4];
+        if (v.userType() == QMetaType::QColor) {
+            const QColor c = v.value<QColor>();
+            f[0] = c.redF();
+            f[1] = c.greenF();
+            f[2] = c.blueF();
+            f[3] = c.alphaF();
+        } else if (v.userType() == QMetaType::QRectF || v.userType() == QMetaType::QRect) {
+            const QRectF r = v.toRectF();
+            f[0] = r.x();
+            f[1] = r.y();
+            f[2] = r.width();
+            f[3] = r.height();
+        } else {
+            const QVector4D vec = v.value<QVector4D>();
+            f[0] = vec.x();
+            f[1] = vec.y();
+            f[2] = vec.z();
+            f[3] = vec.w();
+        }
+        memcpy(dst, f, sizeof(f));
+        break;
+    }
+    }
+}
+
+/*!
+    Constructs a new binding for \a kernel, reading the properties of \a item.
+    The kernel is retained until the binding is destroyed.
+ */
+QQuickCLKernelBinding::QQuickCLKernelBinding(QQuickCLItem *item, cl_kernel kernel)
+    : d_ptr(new QQuickCLKernelBindingPrivate(item, kernel))
+{
+    if (kernel)
+        clRetainKernel(kernel);
+}
+
+QQuickCLKernelBinding::~QQuickCLKernelBinding()
+{
+    Q_D(QQuickCLKernelBinding);
+    if (d->kernel)
+        clReleaseKernel(d->kernel);
+    delete d_ptr;
+}
+
+/*!
+    \return the kernel.
+ */
+cl_kernel QQuickCLKernelBinding::kernel() const
+{
+    Q_D(const QQuickCLKernelBinding);
+    return d->kernel;
+}
+
+/*!
+    Binds the kernel argument \a argIndex to the property \a propertyName of
+    the item. \a type specifies the OpenCL type of the argument.
+
+    \return \c false if the item has no such property.
+ */
+bool QQuickCLKernelBinding::bind(int argIndex, const QByteArray &propertyName, ArgType type)
+{
+    Q_D(QQuickCLKernelBinding);
+    const QMetaObject *mo = d->item->metaObject();
+    const int propIndex = mo->indexOfProperty(propertyName.constData());
+    if (propIndex < 0) {
+        qWarning("QQuickCLKernelBinding: No property %s in %s", propertyName.constData(), mo->className());
+        return false;
+    }
+
+    QQuickCLKernelBindingPrivate::Binding b;
+    b.index = argIndex;
+    b.type = type;
+    b.property = mo->property(propIndex);
+    b.valid = false;
+    for (int i = 0; i < d->bindings.count(); ++i) {
+        if (d->bindings[i].index == argIndex) {
+            d->bindings[i] = b;
+            return true;
+        }
+    }
+    d->bindings.append(b);
+    return true;
+}
+
+/*!
+    Queries the names and types of the kernel's arguments and binds all
+    arguments passed by value that have a supported type to the properties
+    of the item with the same name. Arguments without a matching property
+    are left alone.
+
+    \return \c false when the argument information is not available. This is
+    the case with OpenCL 1.1 and when the program was not built with the
+    \c -cl-kernel-arg-info option. Use bind() in this case.
+ */
+bool QQuickCLKernelBinding::bindFromArgInfo()
+{
+#ifdef CL_VERSION_1_2
+    Q_D(QQuickCLKernelBinding);
+    cl_uint argCount = 0;
+    cl_int err = clGetKernelInfo(d->kernel, CL_KERNEL_NUM_ARGS, sizeof(argCount), &argCount, 0);
+    if (err != CL_SUCCESS) {
+        qWarning("Failed to query the number of kernel arguments: %d", err);
+        return false;
+    }
+
+    static const struct {
+        const char *name;
+        ArgType type;
+    } types[] = {
+        { "int", Int },
+        { "int2", Int2 },
+        { "uint", UInt },
+        { "unsigned int", UInt },
+        { "float", Float },
+        { "float2", Float2 },
+        { "float4", Float4 }
+    };
+
+    const QMetaObject *mo = d->item->metaObject();
+    for (cl_uint i = 0; i < argCount; ++i) {
+        cl_kernel_arg_address_qualifier addressQualifier;
+        err = clGetKernelArgInfo(d->kernel, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER,
+                                 sizeof(addressQualifier), &addressQualifier, 0);
+        if (err == CL_KERNEL_ARG_INFO_NOT_AVAILABLE) {
+            qCDebug(logCL, "Kernel argument info not available, build with -cl-kernel-arg-info");
+            return false;
+        } else if (err != CL_SUCCESS) {
+            qWarning("Failed to query kernel argument info: %d", err);
+            return false;
+        }
+        if (addressQualifier != CL_KERNEL_ARG_ADDRESS_PRIVATE)
+            continue;
+
+        size_t len = 0;
+        clGetKernelArgInfo(d->kernel, i, CL_KERNEL_ARG_TYPE_NAME, 0, 0, &len);
+        QVarLengthArray<char, 32> typeName(int(len) + 1);
+        typeName[0] = '\0';
+        clGetKernelArgInfo(d->kernel, i, CL_KERNEL_ARG_TYPE_NAME, len, typeName.data(), 0);
+        clGetKernelArgInfo(d->kernel, i, CL_KERNEL_ARG_NAME, 0, 0, &len);
+        QVarLengthArray<char, 32> name(int(len) + 1);
+        name[0] = '\0';
+        clGetKernelArgInfo(d->kernel, i, CL_KERNEL_ARG_NAME, len, name.data(), 0);
+
+        if (mo->indexOfProperty(name.constData()) < 0)
+            continue;
+        bool found = false;
+        for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t) {
+            if (!qstrcmp(typeName.constData(), types[t].name)) {
+                bind(i, QByteArray(name.constData()), types[t].type);
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            qWarning("QQuickCLKernelBinding: Unsupported type %s for argument %s",
+                     typeName.constData(), name.constData());
+    }
+    return true;
+#else
+    qCDebug(logCL, "Kernel argument info requires OpenCL 1.2");
+    return false;
+#endif
+}
+
+/*!
+    \return the number of bound arguments.
+ */
+int QQuickCLKernelBinding::bindingCount() const
+{
+    Q_D(const QQuickCLKernelBinding);
+    return d->bindings.count();
+}
+
+/*!
+    Reads the bound properties and sets the kernel arguments whose values have
+    changed since the previous call. Must be called on the render thread while
+    the gui thread is blocked, typically right before enqueuing the kernel.
+
+    \return the number of arguments that were set.
+ */
+int QQuickCLKernelBinding::apply()
+{
+    Q_D(QQuickCLKernelBinding);
+    int count = 0;
+    uchar value[16];
+    for (int i = 0; i < d->bindings.count(); ++i) {
+        QQuickCLKernelBindingPrivate::Binding &b(d->bindings[i]);
+        const size_t size = argSize(b.type);
+        toArg(b.property.read(d->item), b.type, value);
+        if (b.valid && !memcmp(value, b.value, size))
+            continue;
+        cl_int err = clSetKernelArg(d->kernel, b.index, size, value);
+        if (err != CL_SUCCESS) {
+            qWarning("Failed to set kernel argument %d from property %s: %d", b.index, b.property.name(), err);
+            continue;
+        }
+        memcpy(b.value, value, size);
+        b.valid = true;
+        ++count;
+    }
+    return count;
+}
+
+QT_END_NAMESPACE
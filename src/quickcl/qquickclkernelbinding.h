@@ -0,0 +1,81 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QQUICKCLKERNELBINDING_H
+#define QQUICKCLKERNELBINDING_H
+
+#include <QtQuickCL/qtquickclglobal.h>
+#include <QtCore/qbytearray.h>
+
+QT_BEGIN_NAMESPACE
+
+class QQuickCLKernelBindingPrivate;
+class QQuickCLItem;
+
+class Q_QUICKCL_EXPORT QQuickCLKernelBinding
+{
+    Q_DECLARE_PRIVATE(QQuickCLKernelBinding)
+
+public:
+    enum ArgType {
+        Int,
+        Int2,
+        UInt,
+        Float,
+        Float2,
+        Float4
+    };
+
+    QQuickCLKernelBinding(QQuickCLItem *item, cl_kernel kernel);
+    ~QQuickCLKernelBinding();
+
+    cl_kernel kernel() const;
+
+    bool bindFromArgInfo();
+    bool bind(int argIndex, const QByteArray &propertyName, ArgType type);
+    int bindingCount() const;
+
+    int apply();
+
+private:
+    Q_DISABLE_COPY(QQuickCLKernelBinding)
+    QQuickCLKernelBindingPrivate *d_ptr;
+};
+
+QT_END_NAMESPACE
+
+#endif
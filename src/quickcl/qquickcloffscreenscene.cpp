@@ -0,0 +1,479 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "qquickcloffscreenscene.h"
+#include "qquickclitem_p.h"
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QAnimationDriver>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QOpenGLFunctions>
+#include <QtGui/QOpenGLFramebufferObject>
+#include <QtGui/QOffscreenSurface>
+#include <QtQml/QQmlEngine>
+#include <QtQml/QQmlComponent>
+#include <QtQuick/QQuickWindow>
+#include <QtQuick/QQuickRenderControl>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \class QQuickCLOffscreenScene
+
+    \brief QQuickCLOffscreenScene renders a Qt Quick scene containing
+    QQuickCLItem instances without a window.
+
+    The scene is rendered via QQuickRenderControl into a framebuffer object
+    using an OpenGL context bound to a QOffscreenSurface. Everything happens on
+    the thread the scene is used on, which must be the gui thread. This makes
+    it possible to run, measure and verify OpenCL-based items on machines
+    without a display, for example with a software OpenGL implementation like
+    llvmpipe and a CPU OpenCL device. In the latter case there is no CL-GL
+    interop and QQuickCLImageRunnable falls back to copying.
+
+    Frames are not rendered automatically. Instead, each call to renderFrame()
+    processes pending events, advances animations, and polishes, synchronizes
+    and renders the scene. The timings of the last frame are available from
+    lastFrameTiming():
+
+    \list
+    \li \c cpuTime - time spent in polishing, synchronizing and issuing the
+    rendering commands, including the QQuickCLRunnable::update() calls.
+    \li \c clTime - the sum of QQuickCLRunnable::elapsed() over all
+    QQuickCLItem instances in the scene. This is only available when the
+    runnables profile their command queues, see the \c QT_QUICKCL_PROFILE
+    environment variable. Profiling results are collected without waiting,
+    so the value may refer to an earlier frame.
+    \li \c latency - time from the start of the frame until OpenGL, and thus
+    the OpenCL work the frame's textures depend on, has finished.
+    \endlist
+
+    By default animations advance by a fixed step of 16 milliseconds per frame,
+    independently of how fast frames are rendered, in order to get
+    reproducible results. Call setAnimationStep() with \c 0 before load() to
+    use the real time instead.
+
+    \code
+    QQuickCLOffscreenScene scene;
+    if (scene.create(QSize(800, 600)) && scene.load(QUrl::fromLocalFile("scene.qml"))) {
+        for (int i = 0; i < 100; ++i) {
+            scene.renderFrame();
+            qDebug() << scene.lastFrameTiming().latency;
+        }
+    }
+    \endcode
+ */
+
+class StepAnimationDriver : public QAnimationDriver
+{
+public:
+    StepAnimationDriver(int step) : m_step(step), m_time(0) { }
+
+    void step() {
+        m_time += m_step;
+        advance();
+    }
+
+    qint64 elapsed() const Q_DECL_OVERRIDE { return m_time; }
+
+private:
+    int m_step;
+    qint64 m_time;
+};
+
+class QQuickCLOffscreenScenePrivate
+{
+public:
+    QQuickCLOffscreenScenePrivate()
+        : context(0),
+          surface(0),
+          renderControl(0),
+          window(0),
+          engine(0),
+          component(0),
+          rootItem(0),
+          fbo(0),
+          animationDriver(0),
+          animationStep(16)
+    { }
+
+    void collectCLTime(QQuickItem *item, double *t);
+    QQuickCLContext *findCLContext(QQuickItem *item) const;
+
+    QOpenGLContext *context;
+    QOffscreenSurface *surface;
+    QQuickRenderControl *renderControl;
+    QQuickWindow *window;
+    QQmlEngine *engine;
+    QQmlComponent *component;
+    QQuickItem *rootItem;
+    QOpenGLFramebufferObject *fbo;
+    StepAnimationDriver *animationDriver;
+    int animationStep;
+    QSize size;
+    QQuickCLOffscreenScene::FrameTiming timing;
+};
+
+void QQuickCLOffscreenScenePrivate::collectCLTime(QQuickItem *item, double *t)
+{
+    if (QQuickCLItem *clitem = qobject_cast<QQuickCLItem *>(item)) {
+        QQuickCLRunnable *clnode = QQuickCLItemPrivate::get(clitem)->clnode;
+        if (clnode)
+            *t += clnode->elapsed();
+    }
+    foreach (QQuickItem *child, item->childItems())
+        collectCLTime(child, t);
+}
+
+QQuickCLContext *QQuickCLOffscreenScenePrivate::findCLContext(QQuickItem *item) const
+{
+    if (QQuickCLItem *clitem = qobject_cast<QQuickCLItem *>(item)) {
+        if (QQuickCLContext *clctx = clitem->context())
+            return clctx;
+    }
+    foreach (QQuickItem *child, item->childItems()) {
+        if (QQuickCLContext *clctx = findCLContext(child))
+            return clctx;
+    }
+    return 0;
+}
+
+QQuickCLOffscreenScene::QQuickCLOffscreenScene()
+    : d_ptr(new QQuickCLOffscreenScenePrivate)
+{
+}
+
+/*!
+    Destroys the scene. All OpenGL and OpenCL resources are released.
+ */
+QQuickCLOffscreenScene::~QQuickCLOffscreenScene()
+{
+    destroy();
+    delete d_ptr;
+}
+
+/*!
+    Creates the OpenGL context, the offscreen surface and the Qt Quick window
+    rendering into a framebuffer object of the given \a size.
+
+    \return \c true if successful.
+ */
+bool QQuickCLOffscreenScene::create(const QSize &size)
+{
+    Q_D(QQuickCLOffscreenScene);
+    if (d->window)
+        destroy();
+
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setDepthBufferSize(24);
+    format.setStencilBufferSize(8);
+
+    d->context = new QOpenGLContext;
+    d->context->setFormat(format);
+    if (!d->context->create()) {
+        qWarning("Failed to create OpenGL context");
+        destroy();
+        return false;
+    }
+
+    d->surface = new QOffscreenSurface;
+    d->surface->setFormat(d->context->format());
+    d->surface->create();
+    if (!d->surface->isValid() || !d->context->makeCurrent(d->surface)) {
+        qWarning("Failed to make the OpenGL context current on an offscreen surface");
+        destroy();
+        return false;
+    }
+
+    d->size = size;
+    d->renderControl = new QQuickRenderControl;
+    d->window = new QQuickWindow(d->renderControl);
+    d->window->setGeometry(0, 0, size.width(), size.height());
+
+    d->engine = new QQmlEngine;
+    if (!d->engine->incubationController())
+        d->engine->setIncubationController(d->window->incubationController());
+
+    d->renderControl->initialize(d->context);
+    d->fbo = new QOpenGLFramebufferObject(size, QOpenGLFramebufferObject::CombinedDepthStencil);
+    d->window->setRenderTarget(d->fbo);
+
+    return true;
+}
+
+/*!
+    Releases the scene and all associated resources.
+ */
+void QQuickCLOffscreenScene::destroy()
+{
+    Q_D(QQuickCLOffscreenScene);
+    if (d->context && d->surface && d->surface->isValid())
+        d->context->makeCurrent(d->surface);
+
+    // Deleting the render control invalidates the scenegraph, which in turn
+    // releases the runnables and the OpenCL contexts of the items.
+    delete d->renderControl;
+    d->renderControl = 0;
+    delete d->component;
+    d->component = 0;
+    delete d->window;
+    d->window = 0;
+    d->rootItem = 0;
+    delete d->engine;
+    d->engine = 0;
+    delete d->fbo;
+    d->fbo = 0;
+
+    if (d->context)
+        d->context->doneCurrent();
+    delete d->surface;
+    d->surface = 0;
+    delete d->context;
+    d->context = 0;
+
+    if (d->animationDriver) {
+        d->animationDriver->uninstall();
+        delete d->animationDriver;
+        d->animationDriver = 0;
+    }
+
+    d->timing = FrameTiming();
+}
+
+/*!
+    \return \c true if create() was successful.
+ */
+bool QQuickCLOffscreenScene::isValid() const
+{
+    Q_D(const QQuickCLOffscreenScene);
+    return d->window != 0;
+}
+
+/*!
+    Sets the amount of time animations advance with each frame to \a msecs. A
+    value of \c 0 makes animations use the real time. The default is 16.
+
+    \note This must be called before load().
+ */
+void QQuickCLOffscreenScene::setAnimationStep(int msecs)
+{
+    Q_D(QQuickCLOffscreenScene);
+    d->animationStep = msecs;
+}
+
+/*!
+    \return the amount of time animations advance with each frame, or \c 0 when
+    animations are running in real time.
+ */
+int QQuickCLOffscreenScene::animationStep() const
+{
+    Q_D(const QQuickCLOffscreenScene);
+    return d->animationStep;
+}
+
+/*!
+    Loads the QML file \a source. The root object must be an Item. It is
+    resized to the size of the scene.
+
+    \return \c true if successful.
+ */
+bool QQuickCLOffscreenScene::load(const QUrl &source)
+{
+    Q_D(QQuickCLOffscreenScene);
+    if (!d->window) {
+        qWarning("QQuickCLOffscreenScene: load() called without create()");
+        return false;
+    }
+
+    if (d->animationStep > 0 && !d->animationDriver) {
+        d->animationDriver = new StepAnimationDriver(d->animationStep);
+        d->animationDriver->install();
+    }
+
+    delete d->rootItem;
+    d->rootItem = 0;
+    delete d->component;
+    d->component = new QQmlComponent(d->engine, source);
+    if (d->component->isLoading()) {
+        qWarning("QQuickCLOffscreenScene: Only local QML files are supported");
+        return false;
+    }
+    if (d->component->isError()) {
+        foreach (const QQmlError &error, d->component->errors())
+            qWarning() << error;
+        return false;
+    }
+
+    QObject *obj = d->component->create();
+    if (d->component->isError()) {
+        foreach (const QQmlError &error, d->component->errors())
+            qWarning() << error;
+        delete obj;
+        return false;
+    }
+
+    d->rootItem = qobject_cast<QQuickItem *>(obj);
+    if (!d->rootItem) {
+        qWarning("QQuickCLOffscreenScene: The root object is not an Item");
+        delete obj;
+        return false;
+    }
+
+    d->rootItem->setParentItem(d->window->contentItem());
+    d->rootItem->setSize(d->size);
+
+    return true;
+}
+
+/*!
+    \return the QML engine used to load the scene.
+ */
+QQmlEngine *QQuickCLOffscreenScene::engine() const
+{
+    Q_D(const QQuickCLOffscreenScene);
+    return d->engine;
+}
+
+/*!
+    \return the QQuickWindow driven by the QQuickRenderControl.
+ */
+QQuickWindow *QQuickCLOffscreenScene::window() const
+{
+    Q_D(const QQuickCLOffscreenScene);
+    return d->window;
+}
+
+/*!
+    \return the root item of the loaded QML file, or \c null when nothing is
+    loaded.
+ */
+QQuickItem *QQuickCLOffscreenScene::rootItem() const
+{
+    Q_D(const QQuickCLOffscreenScene);
+    return d->rootItem;
+}
+
+/*!
+    \return the OpenGL context used for rendering.
+ */
+QOpenGLContext *QQuickCLOffscreenScene::openGLContext() const
+{
+    Q_D(const QQuickCLOffscreenScene);
+    return d->context;
+}
+
+/*!
+    \return the OpenCL context used by the QQuickCLItem instances of the
+    scene, or \c null when no such item has been rendered yet. The context is
+    shared by all items, see QQuickCLContext::acquireShared().
+ */
+QQuickCLContext *QQuickCLOffscreenScene::clContext() const
+{
+    Q_D(const QQuickCLOffscreenScene);
+    return d->window ? d->findCLContext(d->window->contentItem()) : 0;
+}
+
+/*!
+    \return the size of the scene.
+ */
+QSize QQuickCLOffscreenScene::size() const
+{
+    Q_D(const QQuickCLOffscreenScene);
+    return d->size;
+}
+
+/*!
+    Renders one frame and waits for it to finish. Pending events, for example
+    the ones posted by QQuickCLItem::scheduleUpdate(), are processed first.
+
+    \return \c true if successful.
+ */
+bool QQuickCLOffscreenScene::renderFrame()
+{
+    Q_D(QQuickCLOffscreenScene);
+    if (!d->window)
+        return false;
+
+    QCoreApplication::processEvents();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (d->animationDriver)
+        d->animationDriver->step();
+
+    if (!d->context->makeCurrent(d->surface)) {
+        qWarning("QQuickCLOffscreenScene: Failed to make context current");
+        return false;
+    }
+
+    d->renderControl->polishItems();
+    d->renderControl->sync();
+    d->renderControl->render();
+    d->timing.cpuTime = timer.nsecsElapsed() / 1000000.0;
+
+    d->context->functions()->glFinish();
+    d->timing.latency = timer.nsecsElapsed() / 1000000.0;
+
+    d->timing.clTime = 0;
+    d->collectCLTime(d->window->contentItem(), &d->timing.clTime);
+
+    return true;
+}
+
+/*!
+    \return the timings of the last frame rendered by renderFrame(), in
+    milliseconds.
+ */
+QQuickCLOffscreenScene::FrameTiming QQuickCLOffscreenScene::lastFrameTiming() const
+{
+    Q_D(const QQuickCLOffscreenScene);
+    return d->timing;
+}
+
+/*!
+    \return the contents of the last rendered frame.
+ */
+QImage QQuickCLOffscreenScene::grabFrame()
+{
+    Q_D(QQuickCLOffscreenScene);
+    if (!d->fbo || !d->context->makeCurrent(d->surface))
+        return QImage();
+    return d->fbo->toImage();
+}
+
+QT_END_NAMESPACE
@@ -47,6 +47,7 @@ class Q_QUICKCL_EXPORT QQuickCLRunnable
 public:
     virtual ~QQuickCLRunnable();
     virtual QSGNode *update(QSGNode *node) = 0;
+    virtual double elapsed() const;
 };
 
 QT_END_NAMESPACE
@@ -0,0 +1,485 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qquickclstats_p.h"
+#include <QtCore/QCoreApplication>
+#include <QtCore/QMetaMethod>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QTimerEvent>
+#include <QtQuick/QQuickWindow>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \class QQuickCLStats
+
+    \brief QQuickCLStats collects performance statistics of OpenCL-based
+    items and exposes them as properties to QML.
+
+    Every QQuickCLItem has an instance, available via the \c clStats
+    property, and the items of a window additionally report to an aggregate
+    instance returned by forWindow(). The values are recorded on the render
+    thread and published on the gui thread every updateInterval
+    milliseconds, followed by the updated() signal. This makes the object
+    suitable for bindings, for example in QQuickCLStatsOverlay, without
+    causing a change notification for every frame. Publishing stops while
+    nothing new is recorded and resumes with the next recorded value, so
+    idle items do not wake up the gui thread.
+
+    All times are in milliseconds and are averages for the frames of the last
+    interval:
+
+    \list
+    \li \c kernelTime - The time OpenCL spent executing a frame, measured
+    with profiling events. QQuickCLImageRunnable only reports it when the
+    \c Profile or \c AdaptiveResolution flag is set.
+    \li \c acquireTime - The time the render thread spent making the
+    OpenGL textures available to OpenCL.
+    \li \c releaseTime - The time the render thread spent handing the
+    results back to OpenGL.
+    \li \c blockedTime - The time the render thread was blocked in
+    glFinish(), clFinish() or waiting for OpenCL events. This is mostly
+    included in the acquire and release times.
+    \endlist
+
+    \c frames and \c skippedFrames are the number of frames computed and
+    skipped during the last interval, where a frame is skipped when the
+    item is updated while the computation it depends on is still in
+    progress. \c memoryBytes is the current size of the OpenCL memory
+    objects and output textures, and \c buildTime is the total time spent
+    building OpenCL programs.
+
+    Runnables not based on QQuickCLImageRunnable can report their own
+    numbers via the add functions, which are safe to call on any thread.
+ */
+
+/*!
+    \fn void QQuickCLStats::updated()
+
+    Emitted on the gui thread after publishing the values of the last
+    interval. Intervals in which nothing changed are not published.
+ */
+
+struct CurrentStats {
+    CurrentStats() : stats(0) { }
+    QQuickCLStats *stats;
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<CurrentStats>, currentStats)
+
+QQuickCLStatsPrivate::QQuickCLStatsPrivate()
+    : memory(0),
+      buildTime(0),
+      aggregate(0),
+      publishScheduled(false),
+      publishedMemory(0),
+      publishedBuildTime(0),
+      interval(500),
+      timerId(0)
+{
+}
+
+QQuickCLStats *QQuickCLStatsPrivate::current()
+{
+    return currentStats()->localData().stats;
+}
+
+void QQuickCLStatsPrivate::setCurrent(QQuickCLStats *stats)
+{
+    currentStats()->localData().stats = stats;
+}
+
+void QQuickCLStatsPrivate::record(int Counters::*field, int value)
+{
+    QMutexLocker lock(&mutex);
+    pending.*field += value;
+    schedulePublish();
+    if (aggregate)
+        get(aggregate)->record(field, value);
+}
+
+void QQuickCLStatsPrivate::record(double Counters::*field, double value)
+{
+    QMutexLocker lock(&mutex);
+    pending.*field += value;
+    schedulePublish();
+    if (aggregate)
+        get(aggregate)->record(field, value);
+}
+
+void QQuickCLStatsPrivate::addBuildTime(double ms)
+{
+    QMutexLocker lock(&mutex);
+    buildTime += ms;
+    schedulePublish();
+    if (aggregate)
+        get(aggregate)->addBuildTime(ms);
+}
+
+void QQuickCLStatsPrivate::addMemory(qint64 delta)
+{
+    QMutexLocker lock(&mutex);
+    memory += delta;
+    schedulePublish();
+    if (aggregate)
+        get(aggregate)->addMemory(delta);
+}
+
+static const int EV_PUBLISH = QEvent::User + 131;
+
+// Called with the mutex locked, on any thread. The timer is started on the
+// gui thread, only the first call after publishing stopped posts an event.
+void QQuickCLStatsPrivate::schedulePublish()
+{
+    Q_Q(QQuickCLStats);
+    if (publishScheduled)
+        return;
+    publishScheduled = true;
+    QCoreApplication::postEvent(q, new QEvent(QEvent::Type(EV_PUBLISH)));
+}
+
+// Called on the gui thread. The mutex of an item's stats is always locked
+// before the one of the aggregate.
+void QQuickCLStatsPrivate::setAggregate(QQuickCLStats *stats)
+{
+    Q_Q(QQuickCLStats);
+    QMutexLocker lock(&mutex);
+    if (aggregate == stats)
+        return;
+    if (aggregate) {
+        QQuickCLStatsPrivate *a = get(aggregate);
+        QMutexLocker aggregateLock(&a->mutex);
+        a->members.removeOne(q);
+        a->memory -= memory;
+        a->schedulePublish();
+    }
+    aggregate = stats;
+    if (aggregate) {
+        QQuickCLStatsPrivate *a = get(aggregate);
+        QMutexLocker aggregateLock(&a->mutex);
+        a->members.append(q);
+        a->memory += memory;
+        a->schedulePublish();
+    }
+}
+
+/*!
+    Constructs a new QQuickCLStats instance with the given \a parent.
+ */
+QQuickCLStats::QQuickCLStats(QObject *parent)
+    : QObject(*new QQuickCLStatsPrivate, parent)
+{
+}
+
+QQuickCLStats::~QQuickCLStats()
+{
+    Q_D(QQuickCLStats);
+    d->setAggregate(0);
+    d->mutex.lock();
+    const QVector<QQuickCLStats *> members = d->members;
+    d->members.clear();
+    d->mutex.unlock();
+    foreach (QQuickCLStats *member, members) {
+        QQuickCLStatsPrivate *m = QQuickCLStatsPrivate::get(member);
+        QMutexLocker lock(&m->mutex);
+        m->aggregate = 0;
+    }
+}
+
+/*!
+    \return the aggregate statistics of all QQuickCLItem instances in
+    \a window, creating it when needed. The object is owned by the window.
+    Must be called on the gui thread.
+ */
+QQuickCLStats *QQuickCLStats::forWindow(QQuickWindow *window)
+{
+    QObject *obj = window->findChild<QObject *>(QStringLiteral("_q_quickcl_windowstats"),
+                                                Qt::FindDirectChildrenOnly);
+    if (obj)
+        return static_cast<QQuickCLStats *>(obj);
+    QQuickCLStats *stats = new QQuickCLStats(window);
+    stats->setObjectName(QStringLiteral("_q_quickcl_windowstats"));
+    return stats;
+}
+
+/*!
+    \return the number of frames computed during the last interval.
+ */
+int QQuickCLStats::frames() const
+{
+    Q_D(const QQuickCLStats);
+    return d->published.frames;
+}
+
+/*!
+    \return the number of frames skipped during the last interval.
+ */
+int QQuickCLStats::skippedFrames() const
+{
+    Q_D(const QQuickCLStats);
+    return d->published.skippedFrames;
+}
+
+/*!
+    \return the average OpenCL execution time per profiled frame during the
+    last interval, in milliseconds.
+ */
+double QQuickCLStats::kernelTime() const
+{
+    Q_D(const QQuickCLStats);
+    const int n = d->published.kernelSamples;
+    return n ? d->published.kernelTime / n : 0;
+}
+
+/*!
+    \return the average time per frame spent acquiring the OpenGL textures
+    during the last interval, in milliseconds.
+ */
+double QQuickCLStats::acquireTime() const
+{
+    Q_D(const QQuickCLStats);
+    const int n = d->published.frames;
+    return n ? d->published.acquireTime / n : 0;
+}
+
+/*!
+    \return the average time per frame spent releasing the OpenGL textures
+    during the last interval, in milliseconds.
+ */
+double QQuickCLStats::releaseTime() const
+{
+    Q_D(const QQuickCLStats);
+    const int n = d->published.frames;
+    return n ? d->published.releaseTime / n : 0;
+}
+
+/*!
+    \return the average time per frame the render thread was blocked
+    waiting for OpenGL or OpenCL during the last interval, in milliseconds.
+ */
+double QQuickCLStats::blockedTime() const
+{
+    Q_D(const QQuickCLStats);
+    const int n = d->published.frames;
+    return n ? d->published.blockedTime / n : 0;
+}
+
+/*!
+    \return the size of the allocated OpenCL memory objects and output
+    textures in bytes.
+ */
+qint64 QQuickCLStats::memoryBytes() const
+{
+    Q_D(const QQuickCLStats);
+    return d->publishedMemory;
+}
+
+/*!
+    \return the total time spent building OpenCL programs, in milliseconds.
+    Programs loaded from the program cache contribute only the time needed
+    for loading them.
+ */
+double QQuickCLStats::buildTime() const
+{
+    Q_D(const QQuickCLStats);
+    return d->publishedBuildTime;
+}
+
+/*!
+    \return the interval in milliseconds in which the values are published.
+    The default is 500.
+ */
+int QQuickCLStats::updateInterval() const
+{
+    Q_D(const QQuickCLStats);
+    return d->interval;
+}
+
+/*!
+    Sets the publishing interval to \a ms milliseconds. \c 0 stops
+    publishing, the values keep accumulating until the interval is set
+    again.
+ */
+void QQuickCLStats::setUpdateInterval(int ms)
+{
+    Q_D(QQuickCLStats);
+    if (d->interval == ms)
+        return;
+    if (d->timerId)
+        killTimer(d->timerId);
+    d->interval = ms;
+    QMutexLocker lock(&d->mutex);
+    d->timerId = ms > 0 && d->publishScheduled ? startTimer(ms) : 0;
+    lock.unlock();
+    emit updateIntervalChanged();
+}
+
+/*!
+    Records a computed frame.
+ */
+void QQuickCLStats::addFrame()
+{
+    Q_D(QQuickCLStats);
+    d->record(&QQuickCLStatsPrivate::Counters::frames, 1);
+}
+
+/*!
+    Records a frame that was skipped because the previous computation was
+    still in progress.
+ */
+void QQuickCLStats::addSkippedFrame()
+{
+    Q_D(QQuickCLStats);
+    d->record(&QQuickCLStatsPrivate::Counters::skippedFrames, 1);
+}
+
+/*!
+    Records \a ms milliseconds of OpenCL execution time for one frame.
+ */
+void QQuickCLStats::addKernelTime(double ms)
+{
+    Q_D(QQuickCLStats);
+    d->record(&QQuickCLStatsPrivate::Counters::kernelSamples, 1);
+    d->record(&QQuickCLStatsPrivate::Counters::kernelTime, ms);
+}
+
+/*!
+    Records \a ms milliseconds spent acquiring OpenGL objects.
+ */
+void QQuickCLStats::addAcquireTime(double ms)
+{
+    Q_D(QQuickCLStats);
+    d->record(&QQuickCLStatsPrivate::Counters::acquireTime, ms);
+}
+
+/*!
+    Records \a ms milliseconds spent releasing OpenGL objects.
+ */
+void QQuickCLStats::addReleaseTime(double ms)
+{
+    Q_D(QQuickCLStats);
+    d->record(&QQuickCLStatsPrivate::Counters::releaseTime, ms);
+}
+
+/*!
+    Records \a ms milliseconds spent blocked in glFinish(), clFinish() or
+    similar.
+ */
+void QQuickCLStats::addBlockedTime(double ms)
+{
+    Q_D(QQuickCLStats);
+    d->record(&QQuickCLStatsPrivate::Counters::blockedTime, ms);
+}
+
+/*!
+    Records \a ms milliseconds spent building an OpenCL program.
+    QQuickCLContext does this automatically for builds started from a
+    runnable and for asynchronous builds associated with an item.
+ */
+void QQuickCLStats::addBuildTime(double ms)
+{
+    Q_D(QQuickCLStats);
+    d->addBuildTime(ms);
+}
+
+/*!
+    Sets the size of the memory currently allocated by the item to \a bytes.
+ */
+void QQuickCLStats::setMemoryBytes(qint64 bytes)
+{
+    Q_D(QQuickCLStats);
+    QMutexLocker lock(&d->mutex);
+    const qint64 delta = bytes - d->memory;
+    lock.unlock();
+    if (delta)
+        d->addMemory(delta);
+}
+
+void QQuickCLStats::timerEvent(QTimerEvent *e)
+{
+    Q_D(QQuickCLStats);
+    if (e->timerId() != d->timerId) {
+        QObject::timerEvent(e);
+        return;
+    }
+    QMutexLocker lock(&d->mutex);
+    const QQuickCLStatsPrivate::Counters &p(d->pending);
+    const QQuickCLStatsPrivate::Counters &last(d->published);
+    const bool changed = p.frames || p.skippedFrames || p.kernelSamples
+            || p.acquireTime || p.releaseTime || p.blockedTime
+            || last.frames || last.skippedFrames || last.kernelSamples
+            || last.acquireTime || last.releaseTime || last.blockedTime
+            || d->publishedMemory != d->memory || d->publishedBuildTime != d->buildTime;
+    if (!changed) {
+        // Nothing recorded since the values dropped to zero, stop until the
+        // next value is recorded.
+        killTimer(d->timerId);
+        d->timerId = 0;
+        d->publishScheduled = false;
+        return;
+    }
+    d->published = d->pending;
+    d->pending = QQuickCLStatsPrivate::Counters();
+    d->publishedMemory = d->memory;
+    d->publishedBuildTime = d->buildTime;
+    lock.unlock();
+    emit updated();
+}
+
+bool QQuickCLStats::event(QEvent *e)
+{
+    if (e->type() == EV_PUBLISH) {
+        Q_D(QQuickCLStats);
+        if (!d->timerId && d->interval > 0)
+            d->timerId = startTimer(d->interval);
+        return true;
+    }
+    return QObject::event(e);
+}
+
+void QQuickCLStats::connectNotify(const QMetaMethod &signal)
+{
+    // New receivers, like bindings, get the values recorded so far.
+    if (signal == QMetaMethod::fromSignal(&QQuickCLStats::updated)) {
+        Q_D(QQuickCLStats);
+        QMutexLocker lock(&d->mutex);
+        d->schedulePublish();
+    }
+    QObject::connectNotify(signal);
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,102 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QQUICKCLSTATS_H
+#define QQUICKCLSTATS_H
+
+#include <QtQuickCL/qtquickclglobal.h>
+#include <QtCore/qobject.h>
+
+QT_BEGIN_NAMESPACE
+
+class QQuickCLStatsPrivate;
+class QQuickWindow;
+
+class Q_QUICKCL_EXPORT QQuickCLStats : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(QQuickCLStats)
+    Q_PROPERTY(int frames READ frames NOTIFY updated)
+    Q_PROPERTY(int skippedFrames READ skippedFrames NOTIFY updated)
+    Q_PROPERTY(double kernelTime READ kernelTime NOTIFY updated)
+    Q_PROPERTY(double acquireTime READ acquireTime NOTIFY updated)
+    Q_PROPERTY(double releaseTime READ releaseTime NOTIFY updated)
+    Q_PROPERTY(double blockedTime READ blockedTime NOTIFY updated)
+    Q_PROPERTY(qint64 memoryBytes READ memoryBytes NOTIFY updated)
+    Q_PROPERTY(double buildTime READ buildTime NOTIFY updated)
+    Q_PROPERTY(int updateInterval READ updateInterval WRITE setUpdateInterval NOTIFY updateIntervalChanged)
+
+public:
+    explicit QQuickCLStats(QObject *parent = 0);
+    ~QQuickCLStats();
+
+    static QQuickCLStats *forWindow(QQuickWindow *window);
+
+    int frames() const;
+    int skippedFrames() const;
+    double kernelTime() const;
+    double acquireTime() const;
+    double releaseTime() const;
+    double blockedTime() const;
+    qint64 memoryBytes() const;
+    double buildTime() const;
+
+    int updateInterval() const;
+    void setUpdateInterval(int ms);
+
+    void addFrame();
+    void addSkippedFrame();
+    void addKernelTime(double ms);
+    void addAcquireTime(double ms);
+    void addReleaseTime(double ms);
+    void addBlockedTime(double ms);
+    void addBuildTime(double ms);
+    void setMemoryBytes(qint64 bytes);
+
+signals:
+    void updated();
+    void updateIntervalChanged();
+
+protected:
+    bool event(QEvent *e) Q_DECL_OVERRIDE;
+    void timerEvent(QTimerEvent *e) Q_DECL_OVERRIDE;
+    void connectNotify(const QMetaMethod &signal) Q_DECL_OVERRIDE;
+};
+
+QT_END_NAMESPACE
+
+#endif
@@ -0,0 +1,113 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QQUICKCLSTATS_P_H
+#define QQUICKCLSTATS_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "qquickclstats.h"
+#include <QtCore/private/qobject_p.h>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QQuickCLStatsPrivate : public QObjectPrivate
+{
+    Q_DECLARE_PUBLIC(QQuickCLStats)
+
+public:
+    QQuickCLStatsPrivate();
+
+    static QQuickCLStatsPrivate *get(QQuickCLStats *stats) { return stats->d_func(); }
+
+    // The stats of the item whose runnable is being created or updated on
+    // the calling thread, if any.
+    static QQuickCLStats *current();
+    static void setCurrent(QQuickCLStats *stats);
+
+    struct Counters {
+        Counters()
+            : frames(0), skippedFrames(0), kernelSamples(0),
+              kernelTime(0), acquireTime(0), releaseTime(0), blockedTime(0) { }
+        int frames;
+        int skippedFrames;
+        int kernelSamples;
+        double kernelTime;
+        double acquireTime;
+        double releaseTime;
+        double blockedTime;
+    };
+
+    void record(int Counters::*field, int value);
+    void record(double Counters::*field, double value);
+    void addBuildTime(double ms);
+    void addMemory(qint64 delta);
+    void setAggregate(QQuickCLStats *stats);
+    void schedulePublish();
+
+    // Recorded on any thread, protected by the mutex.
+    QMutex mutex;
+    Counters pending;
+    qint64 memory;
+    double buildTime;
+    QQuickCLStats *aggregate;
+    QVector<QQuickCLStats *> members;
+    // Set while the publishing timer runs or is about to be started.
+    bool publishScheduled;
+
+    // Published values, gui thread only.
+    Counters published;
+    qint64 publishedMemory;
+    double publishedBuildTime;
+    int interval;
+    int timerId;
+};
+
+QT_END_NAMESPACE
+
+#endif
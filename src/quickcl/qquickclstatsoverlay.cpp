@@ -0,0 +1,172 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qquickclstatsoverlay.h"
+#include <QtQuick/private/qquickpainteditem_p.h>
+#include <QtQuick/QQuickWindow>
+#include <QtQml/qqml.h>
+#include <QtCore/QPointer>
+#include <QtGui/QPainter>
+#include <QtGui/QFontMetrics>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \class QQuickCLStatsOverlay
+
+    \brief QQuickCLStatsOverlay is a QQuickItem showing the values of a
+    QQuickCLStats instance as text.
+
+    Unless the \c stats property is set, for example to the \c clStats of an
+    individual item, the aggregate statistics of the window are shown. The
+    overlay only repaints when the statistics are published, so it has a
+    negligible effect on the measurements.
+
+    There is no QML plugin, the application has to register the types via
+    registerQmlTypes() before loading the QML code:
+
+    \code
+    QQuickCLStatsOverlay::registerQmlTypes("quickcl.qt.io", 1, 0);
+    \endcode
+
+    \code
+    CLStatsOverlay {
+        anchors.right: parent.right
+        stats: clItem.clStats
+    }
+    \endcode
+ */
+
+static const int OVERLAY_MARGIN = 4;
+static const int OVERLAY_LINES = 7;
+
+class QQuickCLStatsOverlayPrivate : public QQuickPaintedItemPrivate
+{
+public:
+    QPointer<QQuickCLStats> explicitStats;
+    QPointer<QQuickCLStats> stats;
+};
+
+/*!
+    Constructs a new QQuickCLStatsOverlay with the given \a parent.
+ */
+QQuickCLStatsOverlay::QQuickCLStatsOverlay(QQuickItem *parent)
+    : QQuickPaintedItem(*new QQuickCLStatsOverlayPrivate, parent)
+{
+    QFontMetrics fm((QFont()));
+    setImplicitWidth(fm.width(QStringLiteral("Frames: 000 (skipped 000)")) + 2 * OVERLAY_MARGIN);
+    setImplicitHeight(fm.height() * OVERLAY_LINES + 2 * OVERLAY_MARGIN);
+}
+
+/*!
+    \return the statistics shown by the overlay.
+ */
+QQuickCLStats *QQuickCLStatsOverlay::stats() const
+{
+    Q_D(const QQuickCLStatsOverlay);
+    return d->stats;
+}
+
+/*!
+    Shows \a stats instead of the window's aggregate statistics. Passing
+    \c null reverts to the aggregate.
+ */
+void QQuickCLStatsOverlay::setStats(QQuickCLStats *stats)
+{
+    Q_D(QQuickCLStatsOverlay);
+    d->explicitStats = stats;
+    setCurrentStats(stats ? stats : (window() ? QQuickCLStats::forWindow(window()) : 0));
+}
+
+void QQuickCLStatsOverlay::setCurrentStats(QQuickCLStats *stats)
+{
+    Q_D(QQuickCLStatsOverlay);
+    if (d->stats == stats)
+        return;
+    if (d->stats)
+        disconnect(d->stats, SIGNAL(updated()), this, SLOT(update()));
+    d->stats = stats;
+    if (stats)
+        connect(stats, SIGNAL(updated()), this, SLOT(update()));
+    update();
+    emit statsChanged();
+}
+
+void QQuickCLStatsOverlay::itemChange(ItemChange change, const ItemChangeData &value)
+{
+    Q_D(QQuickCLStatsOverlay);
+    if (change == ItemSceneChange && !d->explicitStats)
+        setCurrentStats(value.window ? QQuickCLStats::forWindow(value.window) : 0);
+    QQuickPaintedItem::itemChange(change, value);
+}
+
+void QQuickCLStatsOverlay::paint(QPainter *painter)
+{
+    Q_D(QQuickCLStatsOverlay);
+    painter->fillRect(boundingRect(), QColor(0, 0, 0, 160));
+    QQuickCLStats *s = d->stats;
+    if (!s)
+        return;
+
+    const QString ms = QStringLiteral("%1: %2 ms");
+    QStringList lines;
+    lines << QStringLiteral("Frames: %1 (skipped %2)").arg(s->frames()).arg(s->skippedFrames())
+          << ms.arg(QStringLiteral("Kernel")).arg(s->kernelTime(), 0, 'f', 2)
+          << ms.arg(QStringLiteral("Acquire")).arg(s->acquireTime(), 0, 'f', 2)
+          << ms.arg(QStringLiteral("Release")).arg(s->releaseTime(), 0, 'f', 2)
+          << ms.arg(QStringLiteral("Blocked")).arg(s->blockedTime(), 0, 'f', 2)
+          << QStringLiteral("Memory: %1 MB").arg(s->memoryBytes() / (1024.0 * 1024.0), 0, 'f', 1)
+          << ms.arg(QStringLiteral("Build")).arg(s->buildTime(), 0, 'f', 0);
+
+    painter->setPen(Qt::white);
+    const QRectF r = boundingRect().adjusted(OVERLAY_MARGIN, OVERLAY_MARGIN, -OVERLAY_MARGIN, -OVERLAY_MARGIN);
+    painter->drawText(r, Qt::AlignLeft | Qt::AlignTop, lines.join(QLatin1Char('\n')));
+}
+
+/*!
+    Registers QQuickCLStats as the uncreatable type \c CLStats and
+    QQuickCLStatsOverlay as \c CLStatsOverlay in the QML module \a uri with
+    the version \a versionMajor.\a versionMinor.
+ */
+void QQuickCLStatsOverlay::registerQmlTypes(const char *uri, int versionMajor, int versionMinor)
+{
+    qmlRegisterUncreatableType<QQuickCLStats>(uri, versionMajor, versionMinor, "CLStats",
+                                              QStringLiteral("CLStats is available via the clStats property of the items"));
+    qmlRegisterType<QQuickCLStatsOverlay>(uri, versionMajor, versionMinor, "CLStatsOverlay");
+}
+
+QT_END_NAMESPACE
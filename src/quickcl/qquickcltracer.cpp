@@ -0,0 +1,412 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qquickcltracer.h"
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(logCL)
+
+/*!
+    \class QQuickCLTracer
+
+    \brief QQuickCLTracer records a timeline of OpenCL commands and render
+    thread activity and exports it in the Chrome trace event format.
+
+    The elapsed() value reported by runnables is a single number per frame.
+    To see where the time goes, the tracer records the device timestamps of
+    the individual commands, like acquiring the textures, each stage of the
+    pipeline and releasing the textures, together with the time spent on the
+    render thread. The resulting JSON file can be loaded into
+    \c{chrome://tracing} or Perfetto.
+
+    Tracing is enabled by setting the environment variable
+    \c QT_QUICKCL_TRACE to the name of the file to write when the
+    application exits, or via setEnabled(). Command queues only provide
+    timestamps when created with \c CL_QUEUE_PROFILING_ENABLE, therefore
+    tracing must be enabled before the items are first rendered.
+    QQuickCLImageRunnable traces its own commands automatically and offers
+    QQuickCLImageRunnable::traceEvent() for the commands enqueued by
+    subclasses. Other runnables can use traceCommand() directly:
+
+    \code
+        QQuickCLTracer *tracer = QQuickCLTracer::instance();
+        cl_event ev = 0;
+        const qint64 t = tracer->timestamp();
+        clEnqueueNDRangeKernel(queue, kernel, 1, 0, &size, 0, 0, 0, tracer->isEnabled() ? &ev : 0);
+        if (ev)
+            tracer->traceCommand(m_track, "update", ev, t);
+    \endcode
+
+    The timestamps are collected from event callbacks, recording never waits
+    for the commands to finish. Device timestamps are mapped to the CPU
+    timeline by assuming that a command was queued when the CPU called the
+    enqueue function.
+
+    All functions are thread-safe.
+ */
+
+struct TraceEvent
+{
+    QByteArray name;
+    int track;
+    bool device;
+    qint64 start;
+    qint64 end;
+    qint64 queued;
+    qint64 submit;
+};
+
+class QQuickCLTracerPrivate
+{
+public:
+    QQuickCLTracerPrivate() : overflow(false) { }
+
+    void append(const TraceEvent &e);
+    static void CL_CALLBACK commandCallback(cl_event event, cl_int status, void *user_data);
+    static void writeOnExit();
+
+    QAtomicInt enabled;
+    QElapsedTimer timer;
+    mutable QMutex mutex;
+    QVector<QByteArray> tracks;
+    QVector<TraceEvent> events;
+    bool overflow;
+    QString exitFileName;
+};
+
+struct PendingCommand
+{
+    QQuickCLTracerPrivate *d;
+    QByteArray name;
+    int track;
+    cl_event begin;
+    cl_event end;
+    qint64 enqueued;
+};
+
+// Keeps the memory usage bounded when tracing is left enabled for long.
+static const int MAX_TRACE_EVENTS = 1000000;
+
+struct QQuickCLTracerInstance
+{
+    QQuickCLTracer tracer;
+};
+
+Q_GLOBAL_STATIC(QQuickCLTracerInstance, globalTracer)
+
+void QQuickCLTracerPrivate::append(const TraceEvent &e)
+{
+    QMutexLocker lock(&mutex);
+    if (events.count() >= MAX_TRACE_EVENTS) {
+        if (!overflow) {
+            qWarning("QQuickCLTracer: Event limit reached, dropping further events");
+            overflow = true;
+        }
+        return;
+    }
+    events.append(e);
+}
+
+void CL_CALLBACK QQuickCLTracerPrivate::commandCallback(cl_event, cl_int status, void *user_data)
+{
+    PendingCommand *cmd = static_cast<PendingCommand *>(user_data);
+    // Commands may complete after the tracer was destroyed on exit.
+    if (status == CL_COMPLETE && !globalTracer.isDestroyed()) {
+        cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+        cl_int err;
+        if (cmd->begin) {
+            // A range between two markers, starting when everything before
+            // the first marker has finished.
+            err = clGetEventProfilingInfo(cmd->begin, CL_PROFILING_COMMAND_QUEUED, sizeof(queued), &queued, 0);
+            err |= clGetEventProfilingInfo(cmd->begin, CL_PROFILING_COMMAND_SUBMIT, sizeof(submit), &submit, 0);
+            err |= clGetEventProfilingInfo(cmd->begin, CL_PROFILING_COMMAND_END, sizeof(start), &start, 0);
+        } else {
+            err = clGetEventProfilingInfo(cmd->end, CL_PROFILING_COMMAND_QUEUED, sizeof(queued), &queued, 0);
+            err |= clGetEventProfilingInfo(cmd->end, CL_PROFILING_COMMAND_SUBMIT, sizeof(submit), &submit, 0);
+            err |= clGetEventProfilingInfo(cmd->end, CL_PROFILING_COMMAND_START, sizeof(start), &start, 0);
+        }
+        err |= clGetEventProfilingInfo(cmd->end, CL_PROFILING_COMMAND_END, sizeof(end), &end, 0);
+        if (err == CL_SUCCESS) {
+            const qint64 offset = cmd->enqueued - qint64(queued);
+            TraceEvent e;
+            e.name = cmd->name;
+            e.track = cmd->track;
+            e.device = true;
+            e.queued = cmd->enqueued;
+            e.submit = qint64(submit) + offset;
+            e.start = qint64(start) + offset;
+            e.end = qint64(end) + offset;
+            cmd->d->append(e);
+        } else {
+            qCDebug(logCL, "No profiling info for %s, queue created without profiling?", cmd->name.constData());
+        }
+    }
+    if (cmd->begin)
+        clReleaseEvent(cmd->begin);
+    clReleaseEvent(cmd->end);
+    delete cmd;
+}
+
+void QQuickCLTracerPrivate::writeOnExit()
+{
+    QQuickCLTracer *tracer = QQuickCLTracer::instance();
+    const QString fileName = tracer->d_func()->exitFileName;
+    if (tracer->writeTrace(fileName))
+        qCDebug(logCL, "QQuickCLTracer: Wrote %d events to %s", tracer->eventCount(), qPrintable(fileName));
+}
+
+QQuickCLTracer::QQuickCLTracer()
+    : d_ptr(new QQuickCLTracerPrivate)
+{
+    Q_D(QQuickCLTracer);
+    d->timer.start();
+    const QByteArray fileName = qgetenv("QT_QUICKCL_TRACE");
+    if (!fileName.isEmpty()) {
+        d->exitFileName = QFile::decodeName(fileName);
+        d->enabled.store(1);
+        qAddPostRoutine(QQuickCLTracerPrivate::writeOnExit);
+    }
+}
+
+QQuickCLTracer::~QQuickCLTracer()
+{
+    delete d_ptr;
+}
+
+/*!
+    \return the process-wide tracer instance.
+ */
+QQuickCLTracer *QQuickCLTracer::instance()
+{
+    return &globalTracer()->tracer;
+}
+
+/*!
+    Enables or disables recording based on \a enable. The already recorded
+    events are kept.
+ */
+void QQuickCLTracer::setEnabled(bool enable)
+{
+    Q_D(QQuickCLTracer);
+    d->enabled.store(enable ? 1 : 0);
+}
+
+/*!
+    \return \c true if recording is enabled.
+ */
+bool QQuickCLTracer::isEnabled() const
+{
+    Q_D(const QQuickCLTracer);
+    return d->enabled.load() != 0;
+}
+
+/*!
+    Registers a new track, shown as a separate thread in the trace viewer,
+    with the given \a name.
+
+    \return the track identifier to pass to the tracing functions.
+ */
+int QQuickCLTracer::addTrack(const QByteArray &name)
+{
+    Q_D(QQuickCLTracer);
+    QMutexLocker lock(&d->mutex);
+    d->tracks.append(name);
+    return d->tracks.count() - 1;
+}
+
+/*!
+    \return the current CPU timestamp in nanoseconds, relative to the
+    creation of the tracer.
+ */
+qint64 QQuickCLTracer::timestamp() const
+{
+    Q_D(const QQuickCLTracer);
+    return d->timer.nsecsElapsed();
+}
+
+/*!
+    Records the OpenCL command associated with \a event under \a name on
+    \a track. \a enqueued is the timestamp() taken right before enqueuing
+    the command. The tracer takes over the reference to \a event and
+    releases it once the timestamps have been collected.
+ */
+void QQuickCLTracer::traceCommand(int track, const QByteArray &name, cl_event event, qint64 enqueued)
+{
+    traceRange(track, name, 0, event, enqueued);
+}
+
+/*!
+    Records a range from the completion of the marker \a begin to the
+    completion of \a end, for example a set of commands enqueued between two
+    calls to \c clEnqueueMarker(). \a enqueued is the timestamp() taken right
+    before enqueuing \a begin. The tracer takes over the references to both
+    events.
+ */
+void QQuickCLTracer::traceRange(int track, const QByteArray &name, cl_event begin, cl_event end, qint64 enqueued)
+{
+    Q_D(QQuickCLTracer);
+    PendingCommand *cmd = new PendingCommand;
+    cmd->d = d;
+    cmd->name = name;
+    cmd->track = track;
+    cmd->begin = begin;
+    cmd->end = end;
+    cmd->enqueued = enqueued;
+    cl_int err = clSetEventCallback(end, CL_COMPLETE, QQuickCLTracerPrivate::commandCallback, cmd);
+    if (err != CL_SUCCESS) {
+        qWarning("Failed to set event callback: %d", err);
+        if (begin)
+            clReleaseEvent(begin);
+        clReleaseEvent(end);
+        delete cmd;
+    }
+}
+
+/*!
+    Records CPU activity under \a name on \a track, lasting from \a start to
+    \a end, both given as timestamp() values.
+ */
+void QQuickCLTracer::traceCpu(int track, const QByteArray &name, qint64 start, qint64 end)
+{
+    Q_D(QQuickCLTracer);
+    TraceEvent e;
+    e.name = name;
+    e.track = track;
+    e.device = false;
+    e.queued = e.submit = e.start = start;
+    e.end = end;
+    d->append(e);
+}
+
+/*!
+    \return the number of recorded events.
+ */
+int QQuickCLTracer::eventCount() const
+{
+    Q_D(const QQuickCLTracer);
+    QMutexLocker lock(&d->mutex);
+    return d->events.count();
+}
+
+/*!
+    Discards the recorded events.
+ */
+void QQuickCLTracer::clear()
+{
+    Q_D(QQuickCLTracer);
+    QMutexLocker lock(&d->mutex);
+    d->events.clear();
+    d->overflow = false;
+}
+
+/*!
+    Writes the recorded events in the Chrome trace event format to \a device.
+
+    Device commands carry their queued and submit times as arguments.
+
+    \return \c true on success.
+ */
+bool QQuickCLTracer::writeTrace(QIODevice *device) const
+{
+    Q_D(const QQuickCLTracer);
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray traceEvents;
+    {
+        QMutexLocker lock(&d->mutex);
+        for (int i = 0; i < d->tracks.count(); ++i) {
+            QJsonObject args;
+            args.insert(QStringLiteral("name"), QString::fromUtf8(d->tracks[i]));
+            QJsonObject meta;
+            meta.insert(QStringLiteral("name"), QStringLiteral("thread_name"));
+            meta.insert(QStringLiteral("ph"), QStringLiteral("M"));
+            meta.insert(QStringLiteral("pid"), pid);
+            meta.insert(QStringLiteral("tid"), i);
+            meta.insert(QStringLiteral("args"), args);
+            traceEvents.append(meta);
+        }
+        foreach (const TraceEvent &e, d->events) {
+            QJsonObject ev;
+            ev.insert(QStringLiteral("name"), QString::fromUtf8(e.name));
+            ev.insert(QStringLiteral("cat"), e.device ? QStringLiteral("cl") : QStringLiteral("cpu"));
+            ev.insert(QStringLiteral("ph"), QStringLiteral("X"));
+            ev.insert(QStringLiteral("pid"), pid);
+            ev.insert(QStringLiteral("tid"), e.track);
+            // The trace event format uses microseconds.
+            ev.insert(QStringLiteral("ts"), e.start / 1000.0);
+            ev.insert(QStringLiteral("dur"), (e.end - e.start) / 1000.0);
+            if (e.device) {
+                QJsonObject args;
+                args.insert(QStringLiteral("queued"), e.queued / 1000.0);
+                args.insert(QStringLiteral("submit"), e.submit / 1000.0);
+                ev.insert(QStringLiteral("args"), args);
+            }
+            traceEvents.append(ev);
+        }
+    }
+
+    QJsonObject root;
+    root.insert(QStringLiteral("traceEvents"), traceEvents);
+    root.insert(QStringLiteral("displayTimeUnit"), QStringLiteral("ms"));
+    return device->write(QJsonDocument(root).toJson(QJsonDocument::Compact)) >= 0;
+}
+
+/*!
+    Writes the recorded events to the file \a fileName.
+
+    \return \c true on success.
+ */
+bool QQuickCLTracer::writeTrace(const QString &fileName) const
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("QQuickCLTracer: Failed to open %s for writing", qPrintable(fileName));
+        return false;
+    }
+    return writeTrace(&f);
+}
+
+QT_END_NAMESPACE
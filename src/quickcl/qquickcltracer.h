@@ -0,0 +1,82 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QQUICKCLTRACER_H
+#define QQUICKCLTRACER_H
+
+#include <QtQuickCL/qtquickclglobal.h>
+#include <QtCore/qbytearray.h>
+#include <QtCore/qstring.h>
+
+QT_BEGIN_NAMESPACE
+
+class QQuickCLTracerPrivate;
+class QIODevice;
+
+class Q_QUICKCL_EXPORT QQuickCLTracer
+{
+    Q_DECLARE_PRIVATE(QQuickCLTracer)
+
+public:
+    static QQuickCLTracer *instance();
+
+    void setEnabled(bool enable);
+    bool isEnabled() const;
+
+    int addTrack(const QByteArray &name);
+    qint64 timestamp() const;
+
+    void traceCommand(int track, const QByteArray &name, cl_event event, qint64 enqueued);
+    void traceRange(int track, const QByteArray &name, cl_event begin, cl_event end, qint64 enqueued);
+    void traceCpu(int track, const QByteArray &name, qint64 start, qint64 end);
+
+    int eventCount() const;
+    void clear();
+    bool writeTrace(QIODevice *device) const;
+    bool writeTrace(const QString &fileName) const;
+
+private:
+    QQuickCLTracer();
+    ~QQuickCLTracer();
+    Q_DISABLE_COPY(QQuickCLTracer)
+    friend struct QQuickCLTracerInstance;
+    QQuickCLTracerPrivate *d_ptr;
+};
+
+QT_END_NAMESPACE
+
+#endif
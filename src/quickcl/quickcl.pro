@@ -10,12 +10,27 @@ HEADERS = \
     qquickclcontext.h \
     qquickclitem.h \
     qquickclrunnable.h \
-    qquickclimagerunnable.h
+    qquickclimagerunnable.h \
+    qquickcloffscreenscene.h \
+    qquickclglsync.h \
+    qquickclkernelbinding.h \
+    qquickcltracer.h \
+    qquickclstats.h \
+    qquickclstatsoverlay.h \
+    qquickclitem_p.h \
+    qquickclimagerunnable_p.h \
+    qquickclstats_p.h
 
 SOURCES = \
     qquickclcontext.cpp \
     qquickclitem.cpp \
-    qquickclimagerunnable.cpp
+    qquickclimagerunnable.cpp \
+    qquickcloffscreenscene.cpp \
+    qquickclglsync.cpp \
+    qquickclkernelbinding.cpp \
+    qquickcltracer.cpp \
+    qquickclstats.cpp \
+    qquickclstatsoverlay.cpp
 
 QMAKE_DOCS = $$PWD/doc/qtquickcl.qdocconf
 
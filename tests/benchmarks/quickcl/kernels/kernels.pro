@@ -0,0 +1,13 @@
+TARGET = tst_bench_kernels
+QT = core gui quickcl testlib
+CONFIG += release
+
+SOURCES += tst_bench_kernels.cpp
+
+RESOURCES += kernels.qrc
+
+osx {
+    LIBS += -framework OpenCL
+} else {
+    LIBS += -lOpenCL
+}
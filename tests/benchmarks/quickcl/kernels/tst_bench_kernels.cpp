@@ -0,0 +1,220 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QtQuickCL/QQuickCLContext>
+
+// Measures the kernels of the histogram and particles examples, without
+// OpenGL. The .cl files are the examples' own, see kernels.qrc.
+
+static const int NUM_BINS = 256;
+static const int NUM_PIXELS_PER_WORKITEM = 32;
+static const int GROUP_SIZE_X = 16;
+static const int GROUP_SIZE_Y = 8;
+
+#define DIV(a, b) ((a + b - 1) / b)
+
+class tst_Bench_Kernels : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_Bench_Kernels() : m_queue(0) { }
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void histogram_data();
+    void histogram();
+    void particles_data();
+    void particles();
+
+private:
+    QQuickCLContext m_clctx;
+    cl_command_queue m_queue;
+};
+
+void tst_Bench_Kernels::initTestCase()
+{
+    QVERIFY(m_clctx.create());
+    qDebug("Platform: %s", m_clctx.platformName().constData());
+    cl_int err;
+    m_queue = clCreateCommandQueue(m_clctx.context(), m_clctx.device(), 0, &err);
+    QVERIFY(m_queue);
+}
+
+void tst_Bench_Kernels::cleanupTestCase()
+{
+    if (m_queue)
+        clReleaseCommandQueue(m_queue);
+    m_clctx.destroy();
+}
+
+void tst_Bench_Kernels::histogram_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("256x256") << 256;
+    QTest::newRow("512x512") << 512;
+    QTest::newRow("1024x1024") << 1024;
+    QTest::newRow("2048x2048") << 2048;
+}
+
+void tst_Bench_Kernels::histogram()
+{
+    QFETCH(int, size);
+
+    QQuickCLContext::DefineMap defines;
+    defines.insert("NUM_BINS", QByteArray::number(NUM_BINS));
+    defines.insert("NUM_PIXELS_PER_WORKITEM", QByteArray::number(NUM_PIXELS_PER_WORKITEM));
+    defines.insert("GROUP_SIZE_X", QByteArray::number(GROUP_SIZE_X));
+    defines.insert("GROUP_SIZE_Y", QByteArray::number(GROUP_SIZE_Y));
+    cl_program program = m_clctx.buildProgramFromFile(QStringLiteral(":/histogram.cl"), QByteArray(), defines);
+    QVERIFY(program);
+    cl_kernel kernel = m_clctx.createKernel(program, "histogram");
+    cl_kernel sumKernel = m_clctx.createKernel(program, "sum_histogram");
+    clReleaseProgram(program);
+    QVERIFY(kernel && sumKernel);
+
+    const size_t numItemsPerRow = DIV(size, NUM_PIXELS_PER_WORKITEM);
+    const size_t numGroupsX = DIV(numItemsPerRow, GROUP_SIZE_X);
+    const size_t numGroupsY = DIV(size, GROUP_SIZE_Y);
+    const cl_int numGroups = cl_int(numGroupsX * numGroupsY);
+    const size_t globalWorkSize[2] = { GROUP_SIZE_X * numGroupsX, GROUP_SIZE_Y * numGroupsY };
+    const size_t localWorkSize[2] = { GROUP_SIZE_X, GROUP_SIZE_Y };
+    const size_t sumWorkSize = NUM_BINS;
+
+    QByteArray pixels(size * size * 4, Qt::Uninitialized);
+    for (int i = 0; i < pixels.size(); ++i)
+        pixels[i] = (i % 4 == 3) ? char(255) : char(qrand());
+    const cl_image_format format = { CL_RGBA, CL_UNORM_INT8 };
+    cl_int err;
+    cl_mem image = clCreateImage2D(m_clctx.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &format,
+                                   size, size, 0, pixels.data(), &err);
+    cl_mem sharedBuf = clCreateBuffer(m_clctx.context(), CL_MEM_READ_WRITE, numGroups * NUM_BINS * sizeof(cl_uint), 0, &err);
+    cl_mem resultBuf = clCreateBuffer(m_clctx.context(), CL_MEM_WRITE_ONLY, NUM_BINS * sizeof(cl_uint), 0, &err);
+    QByteArray result(NUM_BINS * sizeof(cl_uint), Qt::Uninitialized);
+
+    const cl_int numPixelsPerItem = NUM_PIXELS_PER_WORKITEM;
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), &image);
+    clSetKernelArg(kernel, 1, sizeof(cl_int), &numPixelsPerItem);
+    clSetKernelArg(kernel, 2, sizeof(cl_mem), &sharedBuf);
+    clSetKernelArg(sumKernel, 0, sizeof(cl_mem), &sharedBuf);
+    clSetKernelArg(sumKernel, 1, sizeof(cl_int), &numGroups);
+    clSetKernelArg(sumKernel, 2, sizeof(cl_mem), &resultBuf);
+
+    bool ok = image && sharedBuf && resultBuf;
+    if (ok) {
+        QBENCHMARK {
+            ok = clEnqueueNDRangeKernel(m_queue, kernel, 2, 0, globalWorkSize, localWorkSize, 0, 0, 0) == CL_SUCCESS
+                    && clEnqueueNDRangeKernel(m_queue, sumKernel, 1, 0, &sumWorkSize, &sumWorkSize, 0, 0, 0) == CL_SUCCESS
+                    && clEnqueueReadBuffer(m_queue, resultBuf, CL_TRUE, 0, result.size(), result.data(), 0, 0, 0) == CL_SUCCESS;
+            if (!ok)
+                break;
+        }
+    }
+
+    if (resultBuf)
+        clReleaseMemObject(resultBuf);
+    if (sharedBuf)
+        clReleaseMemObject(sharedBuf);
+    if (image)
+        clReleaseMemObject(image);
+    clReleaseKernel(sumKernel);
+    clReleaseKernel(kernel);
+    QVERIFY(ok);
+}
+
+void tst_Bench_Kernels::particles_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::newRow("1K") << 1000;
+    QTest::newRow("10K") << 10000;
+    QTest::newRow("100K") << 100000;
+    QTest::newRow("1M") << 1000000;
+    QTest::newRow("10M") << 10000000;
+}
+
+void tst_Bench_Kernels::particles()
+{
+    QFETCH(int, count);
+
+    cl_program program = m_clctx.buildProgramFromFile(QStringLiteral(":/particles.cl"));
+    QVERIFY(program);
+    cl_kernel kernel = m_clctx.createKernel(program, "updateParticles");
+    clReleaseProgram(program);
+    QVERIFY(kernel);
+
+    QVector<cl_float> infoData(count * 4);
+    for (int i = 0; i < infoData.count(); ++i)
+        infoData[i] = (qrand() % 2000 - 1000) / 1000.0f;
+    cl_int err;
+    cl_mem buf = clCreateBuffer(m_clctx.context(), CL_MEM_READ_WRITE, count * 2 * sizeof(cl_float), 0, &err);
+    cl_mem info = clCreateBuffer(m_clctx.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 infoData.count() * sizeof(cl_float), infoData.data(), &err);
+
+    cl_float t = 0;
+    const cl_float dt = 0.016f;
+    const size_t globalWorkSize = count;
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf);
+    clSetKernelArg(kernel, 2, sizeof(cl_float), &dt);
+    clSetKernelArg(kernel, 3, sizeof(cl_mem), &info);
+
+    bool ok = buf && info;
+    if (ok) {
+        QBENCHMARK {
+            clSetKernelArg(kernel, 1, sizeof(cl_float), &t);
+            ok = clEnqueueNDRangeKernel(m_queue, kernel, 1, 0, &globalWorkSize, 0, 0, 0, 0) == CL_SUCCESS
+                    && clFinish(m_queue) == CL_SUCCESS;
+            if (!ok)
+                break;
+            t += dt;
+        }
+    }
+
+    if (info)
+        clReleaseMemObject(info);
+    if (buf)
+        clReleaseMemObject(buf);
+    clReleaseKernel(kernel);
+    if (!buf || !info)
+        QSKIP("Failed to allocate the particle buffers");
+    QVERIFY(ok);
+}
+
+QTEST_MAIN(tst_Bench_Kernels)
+
+#include "tst_bench_kernels.moc"
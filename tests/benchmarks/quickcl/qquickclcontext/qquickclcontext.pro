@@ -0,0 +1,11 @@
+TARGET = tst_bench_qquickclcontext
+QT = core gui quickcl testlib
+CONFIG += release
+
+SOURCES += tst_bench_qquickclcontext.cpp
+
+osx {
+    LIBS += -framework OpenCL
+} else {
+    LIBS += -lOpenCL
+}
@@ -0,0 +1,139 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QtCore/QTemporaryDir>
+#include <QtQuickCL/QQuickCLContext>
+
+// Measures creating OpenCL contexts and building programs, cold and from
+// the in-memory and on-disk program caches. None of this needs OpenGL, so
+// it runs with CPU OpenCL implementations as well.
+
+static const char *buildSrc =
+        "kernel void scale(global float *buf, float f)\n"
+        "{\n"
+        "    buf[get_global_id(0)] *= f * SCALE;\n"
+        "}\n";
+
+class tst_Bench_QQuickCLContext : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_Bench_QQuickCLContext() : m_serial(0) { }
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void create();
+    void buildProgram_data();
+    void buildProgram();
+
+private:
+    cl_program build(const QByteArray &scale);
+
+    QQuickCLContext m_clctx;
+    QTemporaryDir m_cacheDir;
+    int m_serial;
+};
+
+void tst_Bench_QQuickCLContext::initTestCase()
+{
+    // Keep the on-disk cache away from the user's.
+    QVERIFY(m_cacheDir.isValid());
+    qputenv("QT_QUICKCL_PROGRAM_CACHE_DIR", QFile::encodeName(m_cacheDir.path()));
+    QVERIFY(m_clctx.create());
+    qDebug("Platform: %s", m_clctx.platformName().constData());
+}
+
+void tst_Bench_QQuickCLContext::cleanupTestCase()
+{
+    m_clctx.destroy();
+}
+
+void tst_Bench_QQuickCLContext::create()
+{
+    QBENCHMARK {
+        QQuickCLContext ctx;
+        QVERIFY(ctx.create());
+        ctx.destroy();
+    }
+}
+
+cl_program tst_Bench_QQuickCLContext::build(const QByteArray &scale)
+{
+    QQuickCLContext::DefineMap defines;
+    defines.insert("SCALE", scale);
+    return m_clctx.buildProgram(buildSrc, QByteArray(), defines);
+}
+
+void tst_Bench_QQuickCLContext::buildProgram_data()
+{
+    QTest::addColumn<QString>("mode");
+    QTest::newRow("cold") << QStringLiteral("cold");
+    QTest::newRow("diskCache") << QStringLiteral("diskCache");
+    QTest::newRow("memoryCache") << QStringLiteral("memoryCache");
+}
+
+void tst_Bench_QQuickCLContext::buildProgram()
+{
+    QFETCH(QString, mode);
+    const bool cold = mode == QLatin1String("cold");
+    const bool disk = mode == QLatin1String("diskCache");
+
+    // Populate the caches so that the warm variants never measure a miss.
+    m_clctx.clearProgramCache();
+    cl_program prog = build("1.0f");
+    QVERIFY(prog);
+    clReleaseProgram(prog);
+
+    QBENCHMARK {
+        // A unique value for each cold build defeats all caches, including
+        // the ones in OpenCL implementations.
+        if (disk)
+            m_clctx.clearProgramCache();
+        prog = build(cold ? QByteArray::number(++m_serial) + ".0f" : QByteArray("1.0f"));
+        QVERIFY(prog);
+        clReleaseProgram(prog);
+        if (cold)
+            m_clctx.clearProgramCache();
+    }
+}
+
+QTEST_MAIN(tst_Bench_QQuickCLContext)
+
+#include "tst_bench_qquickclcontext.moc"
@@ -0,0 +1,15 @@
+TARGET = tst_bench_qquickclimagerunnable
+QT = core gui qml quick quickcl testlib
+CONFIG += release
+
+SOURCES += tst_bench_qquickclimagerunnable.cpp
+
+RESOURCES += qquickclimagerunnable.qrc
+
+OTHER_FILES += data/update.qml
+
+osx {
+    LIBS += -framework OpenCL
+} else {
+    LIBS += -lOpenCL
+}
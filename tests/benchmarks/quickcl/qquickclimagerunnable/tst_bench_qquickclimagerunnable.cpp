@@ -0,0 +1,212 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QtQml/QQmlEngine>
+#include <QtQuick/QQuickItem>
+#include <QtQuickCL/QQuickCLItem>
+#include <QtQuickCL/QQuickCLImageRunnable>
+#include <QtQuickCL/QQuickCLContext>
+#include <QtQuickCL/QQuickCLOffscreenScene>
+
+// Measures QQuickCLImageRunnable with a pass-through kernel on a layered,
+// animated source, rendered via QQuickCLOffscreenScene. update() measures
+// the runnable alone, frame the whole frame until OpenGL has finished.
+
+static const char *copySrc =
+        "constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;\n"
+        "kernel void copy(read_only image2d_t imgIn, write_only image2d_t imgOut)\n"
+        "{\n"
+        "    int2 coord = (int2)(get_global_id(0), get_global_id(1));\n"
+        "    write_imagef(imgOut, coord, read_imagef(imgIn, sampler, coord));\n"
+        "}\n";
+
+class PassThroughItem : public QQuickCLItem
+{
+    Q_OBJECT
+    Q_PROPERTY(QQuickItem *source READ source WRITE setSource NOTIFY sourceChanged)
+
+public:
+    PassThroughItem() : m_source(0), m_runnable(0) { }
+
+    QQuickCLRunnable *createCL() Q_DECL_OVERRIDE;
+    QQuickCLRunnable *runnable() const { return m_runnable; }
+
+    QQuickItem *source() const { return m_source; }
+    void setSource(QQuickItem *source) {
+        if (m_source != source) {
+            m_source = source;
+            emit sourceChanged();
+            scheduleUpdate();
+        }
+    }
+
+signals:
+    void sourceChanged();
+
+private:
+    QQuickItem *m_source;
+    QQuickCLRunnable *m_runnable;
+};
+
+class PassThroughRunnable : public QQuickCLImageRunnable
+{
+public:
+    PassThroughRunnable(QQuickCLItem *item)
+        : QQuickCLImageRunnable(item),
+          m_kernel(0)
+    {
+        m_program = item->context()->buildProgram(copySrc);
+        if (m_program)
+            m_kernel = item->context()->createKernel(m_program, "copy");
+    }
+
+    ~PassThroughRunnable() {
+        if (m_kernel)
+            clReleaseKernel(m_kernel);
+        if (m_program)
+            clReleaseProgram(m_program);
+    }
+
+    void runKernel(cl_mem inImage, cl_mem outImage, const QSize &size) Q_DECL_OVERRIDE {
+        if (!m_kernel)
+            return;
+        clSetKernelArg(m_kernel, 0, sizeof(cl_mem), &inImage);
+        clSetKernelArg(m_kernel, 1, sizeof(cl_mem), &outImage);
+        const size_t workSize[] = { size_t(size.width()), size_t(size.height()) };
+        clEnqueueNDRangeKernel(commandQueue(), m_kernel, 2, 0, workSize, 0, 0, 0, 0);
+    }
+
+private:
+    cl_program m_program;
+    cl_kernel m_kernel;
+};
+
+QQuickCLRunnable *PassThroughItem::createCL()
+{
+    m_runnable = new PassThroughRunnable(this);
+    return m_runnable;
+}
+
+class tst_Bench_QQuickCLImageRunnable : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void update_data();
+    void update();
+    void frame_data();
+    void frame();
+
+private:
+    bool loadScene(QQuickCLOffscreenScene *scene, int size, PassThroughItem **item);
+};
+
+void tst_Bench_QQuickCLImageRunnable::initTestCase()
+{
+    qmlRegisterType<PassThroughItem>("QuickCLBench", 1, 0, "PassThrough");
+}
+
+bool tst_Bench_QQuickCLImageRunnable::loadScene(QQuickCLOffscreenScene *scene, int size, PassThroughItem **item)
+{
+    if (!scene->create(QSize(size, size)) || !scene->load(QUrl(QStringLiteral("qrc:/data/update.qml"))))
+        return false;
+    *item = scene->rootItem()->findChild<PassThroughItem *>(QStringLiteral("passThrough"));
+    // The first frames build the program and allocate the images.
+    for (int i = 0; i < 5; ++i) {
+        if (!scene->renderFrame())
+            return false;
+    }
+    return *item && (*item)->runnable();
+}
+
+static void addSizes()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("256x256") << 256;
+    QTest::newRow("512x512") << 512;
+    QTest::newRow("1024x1024") << 1024;
+    QTest::newRow("2048x2048") << 2048;
+}
+
+void tst_Bench_QQuickCLImageRunnable::update_data()
+{
+    addSizes();
+}
+
+// Calls update() directly, with the OpenGL context left current by
+// renderFrame(), on a node of its own so that the scene's node is not
+// affected. This includes enqueuing the kernel and synchronizing with
+// OpenGL, but nothing else of the frame.
+void tst_Bench_QQuickCLImageRunnable::update()
+{
+    QFETCH(int, size);
+    QQuickCLOffscreenScene scene;
+    PassThroughItem *item = 0;
+    QVERIFY(loadScene(&scene, size, &item));
+    qDebug("Platform: %s", item->context()->platformName().constData());
+
+    QSGNode *node = item->runnable()->update(0);
+    QVERIFY(node);
+    QBENCHMARK {
+        node = item->runnable()->update(node);
+    }
+    delete node;
+}
+
+void tst_Bench_QQuickCLImageRunnable::frame_data()
+{
+    addSizes();
+}
+
+void tst_Bench_QQuickCLImageRunnable::frame()
+{
+    QFETCH(int, size);
+    QQuickCLOffscreenScene scene;
+    PassThroughItem *item = 0;
+    QVERIFY(loadScene(&scene, size, &item));
+
+    QBENCHMARK {
+        item->scheduleUpdate();
+        QVERIFY(scene.renderFrame());
+    }
+}
+
+QTEST_MAIN(tst_Bench_QQuickCLImageRunnable)
+
+#include "tst_bench_qquickclimagerunnable.moc"
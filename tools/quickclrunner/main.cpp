@@ -0,0 +1,263 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+**
+** This file is part of the Qt Quick CL module
+**
+** $QT_BEGIN_LICENSE:LGPL3$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see http://www.qt.io/terms-conditions. For further
+** information use the contact form at http://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPLv3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or later as published by the Free
+** Software Foundation and appearing in the file LICENSE.GPL included in
+** the packaging of this file. Please review the following information to
+** ensure the GNU General Public License version 2.0 requirements will be
+** met: http://www.gnu.org/licenses/gpl-2.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtGui/QGuiApplication>
+#include <QtQml/QQmlEngine>
+#include <QtQuickCL/QQuickCLContext>
+#include <QtQuickCL/QQuickCLOffscreenScene>
+#include <QtQuickCL/QQuickCLTracer>
+
+#include <algorithm>
+#include <stdio.h>
+
+// Loads a QML file into a QQuickCLOffscreenScene, renders a number of frames
+// and reports the per-frame CPU, OpenCL and end-to-end times. Custom
+// QQuickCLItem types have to be provided by QML plugins found via -I.
+
+struct Summary
+{
+    Summary(QVector<double> v) {
+        std::sort(v.begin(), v.end());
+        min = v.isEmpty() ? 0 : v.first();
+        max = v.isEmpty() ? 0 : v.last();
+        double sum = 0;
+        foreach (double d, v)
+            sum += d;
+        avg = v.isEmpty() ? 0 : sum / v.count();
+        median = v.isEmpty() ? 0 : v[v.count() / 2];
+        p95 = v.isEmpty() ? 0 : v[qMin(v.count() - 1, int(v.count() * 0.95))];
+    }
+
+    QJsonObject toJson() const {
+        QJsonObject o;
+        o.insert(QStringLiteral("min"), min);
+        o.insert(QStringLiteral("avg"), avg);
+        o.insert(QStringLiteral("median"), median);
+        o.insert(QStringLiteral("p95"), p95);
+        o.insert(QStringLiteral("max"), max);
+        return o;
+    }
+
+    double min, max, avg, median, p95;
+};
+
+static void printSummary(const char *name, const Summary &s)
+{
+    printf("%-8s min %8.3f  avg %8.3f  median %8.3f  p95 %8.3f  max %8.3f ms\n",
+           name, s.min, s.avg, s.median, s.p95, s.max);
+}
+
+int main(int argc, char **argv)
+{
+    // Must be decided before the application and the OpenGL implementation
+    // are initialized, hence checking argv directly.
+    for (int i = 1; i < argc; ++i) {
+        if (!qstrcmp(argv[i], "--software-gl")) {
+            qputenv("LIBGL_ALWAYS_SOFTWARE", "1");
+            QCoreApplication::setAttribute(Qt::AA_UseSoftwareOpenGL);
+        } else if (!qstrcmp(argv[i], "--profile")) {
+            qputenv("QT_QUICKCL_PROFILE", "1");
+        }
+    }
+
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Renders a Qt Quick scene with OpenCL items offscreen and reports frame timings."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("file"), QStringLiteral("The QML file to load."));
+    QCommandLineOption framesOption(QStringList() << QStringLiteral("n") << QStringLiteral("frames"),
+                                    QStringLiteral("Number of frames to measure (default 100)."),
+                                    QStringLiteral("count"), QStringLiteral("100"));
+    QCommandLineOption warmupOption(QStringLiteral("warmup"),
+                                    QStringLiteral("Number of frames rendered before measuring (default 10)."),
+                                    QStringLiteral("count"), QStringLiteral("10"));
+    QCommandLineOption rateOption(QStringLiteral("rate"),
+                                  QStringLiteral("Frames per second, 0 renders unthrottled (default 0)."),
+                                  QStringLiteral("fps"), QStringLiteral("0"));
+    QCommandLineOption sizeOption(QStringLiteral("size"),
+                                  QStringLiteral("Size of the scene (default 800x600)."),
+                                  QStringLiteral("WxH"), QStringLiteral("800x600"));
+    QCommandLineOption stepOption(QStringLiteral("animation-step"),
+                                  QStringLiteral("Milliseconds animations advance per frame, 0 for real time (default 16)."),
+                                  QStringLiteral("ms"), QStringLiteral("16"));
+    QCommandLineOption deviceOption(QStringLiteral("device"),
+                                    QStringLiteral("OpenCL device selection, in the format of QT_QUICKCL_DEVICE."),
+                                    QStringLiteral("spec"));
+    QCommandLineOption importOption(QStringLiteral("I"),
+                                    QStringLiteral("Adds a QML import path."),
+                                    QStringLiteral("path"));
+    QCommandLineOption grabOption(QStringLiteral("grab"),
+                                  QStringLiteral("Saves the last frame to an image file."),
+                                  QStringLiteral("file"));
+    QCommandLineOption jsonOption(QStringLiteral("json"), QStringLiteral("Outputs JSON instead of text."));
+    QCommandLineOption profileOption(QStringLiteral("profile"),
+                                     QStringLiteral("Enables OpenCL profiling to report OpenCL times."));
+    QCommandLineOption traceOption(QStringLiteral("trace"),
+                                   QStringLiteral("Writes a Chrome trace of the measured frames."),
+                                   QStringLiteral("file"));
+    QCommandLineOption softwareOption(QStringLiteral("software-gl"),
+                                      QStringLiteral("Requests a software OpenGL implementation."));
+    parser.addOption(framesOption);
+    parser.addOption(warmupOption);
+    parser.addOption(rateOption);
+    parser.addOption(sizeOption);
+    parser.addOption(stepOption);
+    parser.addOption(deviceOption);
+    parser.addOption(importOption);
+    parser.addOption(grabOption);
+    parser.addOption(jsonOption);
+    parser.addOption(profileOption);
+    parser.addOption(traceOption);
+    parser.addOption(softwareOption);
+    parser.process(app);
+
+    if (parser.positionalArguments().count() != 1)
+        parser.showHelp(1);
+
+    const int frames = qMax(1, parser.value(framesOption).toInt());
+    const int warmup = qMax(0, parser.value(warmupOption).toInt());
+    const double rate = parser.value(rateOption).toDouble();
+    const QStringList sizeSpec = parser.value(sizeOption).split(QLatin1Char('x'));
+    QSize size(800, 600);
+    if (sizeSpec.count() == 2)
+        size = QSize(sizeSpec[0].toInt(), sizeSpec[1].toInt());
+    if (size.isEmpty()) {
+        fprintf(stderr, "Invalid size %s\n", qPrintable(parser.value(sizeOption)));
+        return 1;
+    }
+
+    if (parser.isSet(deviceOption))
+        QQuickCLContext::setDefaultDeviceSelector(QQuickCLDeviceSelector::fromString(parser.value(deviceOption).toLatin1()));
+
+    // The command queues are created with profiling enabled only when tracing
+    // is enabled before the items are first rendered.
+    QQuickCLTracer *tracer = QQuickCLTracer::instance();
+    if (parser.isSet(traceOption))
+        tracer->setEnabled(true);
+
+    QQuickCLOffscreenScene scene;
+    scene.setAnimationStep(parser.value(stepOption).toInt());
+    if (!scene.create(size))
+        return 1;
+    foreach (const QString &path, parser.values(importOption))
+        scene.engine()->addImportPath(path);
+    const QString file = parser.positionalArguments().first();
+    if (!scene.load(QUrl::fromLocalFile(file)))
+        return 1;
+
+    QVector<double> cpuTimes, clTimes, latencies;
+    cpuTimes.reserve(frames);
+    clTimes.reserve(frames);
+    latencies.reserve(frames);
+
+    const qint64 interval = rate > 0 ? qint64(1000000000.0 / rate) : 0;
+    QElapsedTimer clock;
+    clock.start();
+    qint64 deadline = 0;
+
+    for (int i = 0; i < warmup + frames; ++i) {
+        if (interval) {
+            const qint64 remaining = deadline - clock.nsecsElapsed();
+            if (remaining > 0)
+                QThread::usleep(remaining / 1000);
+            deadline = qMax(deadline, clock.nsecsElapsed()) + interval;
+        }
+        if (i == warmup && tracer->isEnabled())
+            tracer->clear();
+        if (!scene.renderFrame())
+            return 1;
+        if (i >= warmup) {
+            const QQuickCLOffscreenScene::FrameTiming t = scene.lastFrameTiming();
+            cpuTimes.append(t.cpuTime);
+            clTimes.append(t.clTime);
+            latencies.append(t.latency);
+        }
+    }
+
+    if (parser.isSet(traceOption) && !tracer->writeTrace(parser.value(traceOption)))
+        fprintf(stderr, "Failed to write %s\n", qPrintable(parser.value(traceOption)));
+
+    if (parser.isSet(grabOption) && !scene.grabFrame().save(parser.value(grabOption)))
+        fprintf(stderr, "Failed to save %s\n", qPrintable(parser.value(grabOption)));
+
+    QQuickCLContext *clctx = scene.clContext();
+    const QString platform = clctx ? QString::fromLatin1(clctx->platformName()) : QString();
+    const bool interop = clctx && clctx->isGLInteropEnabled();
+
+    if (parser.isSet(jsonOption)) {
+        QJsonArray frameArray;
+        for (int i = 0; i < frames; ++i) {
+            QJsonObject f;
+            f.insert(QStringLiteral("cpuTime"), cpuTimes[i]);
+            f.insert(QStringLiteral("clTime"), clTimes[i]);
+            f.insert(QStringLiteral("latency"), latencies[i]);
+            frameArray.append(f);
+        }
+        QJsonObject summary;
+        summary.insert(QStringLiteral("cpuTime"), Summary(cpuTimes).toJson());
+        summary.insert(QStringLiteral("clTime"), Summary(clTimes).toJson());
+        summary.insert(QStringLiteral("latency"), Summary(latencies).toJson());
+        QJsonObject root;
+        root.insert(QStringLiteral("file"), file);
+        root.insert(QStringLiteral("width"), size.width());
+        root.insert(QStringLiteral("height"), size.height());
+        root.insert(QStringLiteral("rate"), rate);
+        root.insert(QStringLiteral("platform"), platform);
+        root.insert(QStringLiteral("glInterop"), interop);
+        root.insert(QStringLiteral("frames"), frameArray);
+        root.insert(QStringLiteral("summary"), summary);
+        fputs(QJsonDocument(root).toJson().constData(), stdout);
+    } else {
+        printf("%s, %dx%d, %d frames, %s\n", qPrintable(file), size.width(), size.height(), frames,
+               interop ? "CL-GL interop" : "copying");
+        for (int i = 0; i < frames; ++i)
+            printf("frame %4d  cpu %8.3f  cl %8.3f  latency %8.3f ms\n", i, cpuTimes[i], clTimes[i], latencies[i]);
+        printSummary("cpu", Summary(cpuTimes));
+        printSummary("cl", Summary(clTimes));
+        printSummary("latency", Summary(latencies));
+    }
+
+    return 0;
+}
@@ -0,0 +1,7 @@
+QT = core gui qml quick quickcl
+
+SOURCES = main.cpp
+
+QMAKE_TARGET_DESCRIPTION = Qt Quick CL Offscreen Scene Runner
+
+load(qt_app)